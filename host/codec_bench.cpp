@@ -0,0 +1,469 @@
+/*
+ * Micro-benchmarks of the codec hot paths for the host build: COBS encode
+ * and decode, CRC16, and frame parsing and creation. Every case is run
+ * several times and the spread across runs is reported, so changes can be
+ * compared between commits.
+ *
+ * Usage: codec_bench [-r runs] [-t ms per run] [-l label] [-o output.csv]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <unistd.h>
+#include "vex.h"
+#include "cobs.h"
+#include "crc16.h"
+#include "serial_frame.h"
+#include "spsc_ringbuffer.h"
+
+/*
+ * The largest frame benchmarked, the receive frame buffer of serial_thread.
+ */
+constexpr size_t max_frame = 4096;
+
+/*
+ * The frame sizes swept, in bytes.
+ */
+const size_t frame_sizes[] = { 16, 64, 256, 1024, max_frame };
+
+/*
+ * The fractions of zero bytes swept for COBS, in percent.
+ */
+const int zero_densities[] = { 0, 1, 10, 50 };
+
+/*
+ * A payload size mix of the frames parsed and created.
+ */
+struct payload_mix
+{
+    const char *name;
+
+    /*
+     * The smallest and largest payload size, drawn uniformly.
+     */
+    uint8_t min_size;
+    uint8_t max_size;
+};
+
+/*
+ * The payload size mixes swept.
+ */
+const payload_mix payload_mixes[] =
+{
+    { "empty", 0, 0 },
+    { "word", 4, 4 },
+    { "full", 8, 8 },
+    { "mixed", 0, 8 }
+};
+
+/*
+ * The result of one benchmark case.
+ */
+struct bench_result
+{
+    /*
+     * Nanoseconds per byte of the fastest, median and slowest run.
+     */
+    double ns_per_byte[3];
+
+    /*
+     * Commands per microsecond of the median run, or 0 for byte codecs.
+     */
+    double commands_per_us;
+};
+
+/*
+ * Settings shared by every case.
+ */
+static int runs = 7;
+static int run_ms = 20;
+
+/*
+ * Keeps the compiler from dropping benchmarked calls.
+ */
+static volatile size_t sink;
+
+/*
+ * Returns a monotonic time, in nanoseconds.
+ */
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Runs an operation repeatedly for run_ms, runs times, and summarizes the
+ * time per byte.
+ *
+ * @param op The operation. Called with an iteration count, it returns the
+ * nanoseconds spent in the measured part of those iterations.
+ * @param bytes The bytes processed by one iteration.
+ * @param commands The commands processed by one iteration.
+ */
+template <typename OP>
+static bench_result measure(OP op, size_t bytes, size_t commands)
+{
+    /*
+     * Find an iteration count that fills a run, then time every run with it.
+     */
+    uint64_t iterations = 1;
+    while(op(iterations) < static_cast<uint64_t>(run_ms) * 1000000 / 4)
+    {
+        iterations *= 2;
+    }
+
+    iterations *= 4;
+
+    double per_iteration[64];
+    int count = std::min(runs, 64);
+    for(int i = 0; i < count; i++)
+    {
+        per_iteration[i] = static_cast<double>(op(iterations)) / iterations;
+    }
+
+    std::sort(per_iteration, per_iteration + count);
+
+    bench_result result;
+    result.ns_per_byte[0] = per_iteration[0] / bytes;
+    result.ns_per_byte[1] = per_iteration[count / 2] / bytes;
+    result.ns_per_byte[2] = per_iteration[count - 1] / bytes;
+    result.commands_per_us = commands > 0 ? commands * 1000.0 / per_iteration[count / 2] : 0;
+    return result;
+}
+
+/*
+ * Fills a buffer with random bytes, of which about a fraction are zero.
+ */
+static void fill_random(std::mt19937 &rng, uint8_t *buf, size_t len, int zero_percent)
+{
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> byte(1, 255);
+
+    for(size_t i = 0; i < len; i++)
+    {
+        buf[i] = percent(rng) < zero_percent ? 0 : static_cast<uint8_t>(byte(rng));
+    }
+}
+
+/*
+ * Fills a queue with random commands of a payload mix.
+ */
+static void fill_commands(std::mt19937 &rng,
+                          abstract_queue<serial_command> &queue,
+                          const payload_mix &mix)
+{
+    std::uniform_int_distribution<int> size(mix.min_size, mix.max_size);
+    std::uniform_int_distribution<int> byte(0, 255);
+    uint16_t address = 0;
+
+    while(!queue.full())
+    {
+        serial_command command;
+        command.address = address++ & 0x3FFF;
+        command.payload_size = static_cast<uint8_t>(size(rng));
+        for(size_t i = 0; i < command.payload_size; i++)
+        {
+            command.data[i] = static_cast<uint8_t>(byte(rng));
+        }
+
+        queue.push(command);
+    }
+}
+
+/*
+ * Writes one result to the terminal and, if open, to the CSV output.
+ */
+static void report(FILE *csv,
+                   const char *label,
+                   const char *bench,
+                   size_t size,
+                   int zero_percent,
+                   const char *mix,
+                   size_t commands,
+                   const bench_result &result)
+{
+    printf("%-12s %5lu %4d%% %-6s %4lu  %7.3f ns/B  [%7.3f - %7.3f]",
+           bench, static_cast<unsigned long>(size), zero_percent, mix,
+           static_cast<unsigned long>(commands),
+           result.ns_per_byte[1], result.ns_per_byte[0], result.ns_per_byte[2]);
+
+    if(result.commands_per_us > 0)
+    {
+        printf("  %7.2f cmd/us", result.commands_per_us);
+    }
+
+    printf("\n");
+
+    if(csv != nullptr)
+    {
+        fprintf(csv, "%s,%s,%lu,%d,%s,%lu,%d,%.4f,%.4f,%.4f,%.4f\n",
+                label, bench, static_cast<unsigned long>(size), zero_percent, mix,
+                static_cast<unsigned long>(commands), runs,
+                result.ns_per_byte[0], result.ns_per_byte[1], result.ns_per_byte[2],
+                result.commands_per_us);
+    }
+}
+
+/*
+ * A CRC16 implementation benchmarked.
+ */
+struct crc16_variant
+{
+    const char *name;
+    uint16_t (*checksum)(const uint8_t *data, size_t length);
+};
+
+/*
+ * The CRC16 implementations swept. crc16 is the one the serial stack uses;
+ * the others show what its table layout is chosen over.
+ */
+const crc16_variant crc16_variants[] =
+{
+    { "crc16", crc::crc16 },
+    { "crc16_byte", crc::crc16_bytewise },
+    { "crc16_slice4", crc::crc16_slice4 },
+    { "crc16_slice8", crc::crc16_slice8 }
+};
+
+/*
+ * Benchmarks COBS encoding and decoding and every CRC16 implementation over
+ * random bytes.
+ */
+static void bench_bytes(FILE *csv, const char *label, std::mt19937 &rng)
+{
+    static uint8_t data[max_frame];
+    static uint8_t encoded[max_frame + max_frame / 254 + 2];
+    static uint8_t decoded[max_frame];
+
+    for(size_t size : frame_sizes)
+    {
+        for(int zeros : zero_densities)
+        {
+            fill_random(rng, data, size, zeros);
+            size_t encoded_len = cobs::encode(data, size, encoded);
+
+            report(csv, label, "cobs_encode", size, zeros, "-", 0,
+                   measure([&](uint64_t n)
+                   {
+                       uint64_t start = now_ns();
+                       for(uint64_t i = 0; i < n; i++)
+                       {
+                           sink = cobs::encode(data, size, encoded);
+                       }
+                       return now_ns() - start;
+                   }, size, 0));
+
+            report(csv, label, "cobs_decode", size, zeros, "-", 0,
+                   measure([&](uint64_t n)
+                   {
+                       uint64_t start = now_ns();
+                       for(uint64_t i = 0; i < n; i++)
+                       {
+                           sink = cobs::decode(encoded, encoded_len, decoded);
+                       }
+                       return now_ns() - start;
+                   }, size, 0));
+
+            /*
+             * The streaming decoder the serial port uses, fed the whole
+             * frame and its delimiter at once.
+             */
+            encoded[encoded_len] = 0;
+            report(csv, label, "cobs_stream", size, zeros, "-", 0,
+                   measure([&](uint64_t n)
+                   {
+                       cobs::decoder decoder;
+                       size_t consumed;
+                       uint64_t start = now_ns();
+                       for(uint64_t i = 0; i < n; i++)
+                       {
+                           decoder.reset(decoded, sizeof(decoded));
+                           sink = decoder.feed(encoded, encoded_len + 1, consumed);
+                       }
+                       return now_ns() - start;
+                   }, size, 0));
+        }
+
+        for(const crc16_variant &variant : crc16_variants)
+        {
+            report(csv, label, variant.name, size, 0, "-", 0,
+                   measure([&](uint64_t n)
+                   {
+                       uint64_t start = now_ns();
+                       for(uint64_t i = 0; i < n; i++)
+                       {
+                           sink = variant.checksum(data, size);
+                       }
+                       return now_ns() - start;
+                   }, size, 0));
+        }
+    }
+}
+
+/*
+ * Benchmarks parsing and creating v1 frames of random commands.
+ */
+static void bench_frames(FILE *csv, const char *label, std::mt19937 &rng)
+{
+    static uint8_t frame[max_frame];
+    static uint8_t created[max_frame + 0x20];
+    static uint8_t encoded[max_frame + max_frame / 254 + 0x20];
+    static spsc_ringbuffer<serial_command, 1024> source;
+    static spsc_ringbuffer<serial_command, 1024> queue;
+    static serial_command commands_buf[1024];
+
+    for(size_t size : frame_sizes)
+    {
+        for(const payload_mix &mix : payload_mixes)
+        {
+            /*
+             * Build one frame of the size to parse, and keep its commands
+             * so every case moves the same commands.
+             */
+            source.clear();
+            fill_commands(rng, source, mix);
+            for(size_t i = 0; i < source.size(); i++)
+            {
+                commands_buf[i] = source.peek(i);
+            }
+
+            size_t frame_len = serial_frame_handler::queue2buf(source, frame, size);
+            size_t commands = serial_frame_handler::command_count(frame, frame_len - 1);
+
+            /*
+             * Skip sizes too small to hold a command, and make sure the
+             * frame parses before timing it.
+             */
+            if(commands == 0)
+            {
+                continue;
+            }
+
+            queue.clear();
+            if(!serial_frame_handler::buf2queue(frame, frame_len - 1, queue) ||
+               queue.size() != commands)
+            {
+                fprintf(stderr, "frame of %lu bytes does not parse\n",
+                        static_cast<unsigned long>(size));
+                return;
+            }
+
+            queue.clear();
+
+            /*
+             * Master frames carry no trailing 0.
+             */
+            report(csv, label, "buf2queue", size, 0, mix.name, commands,
+                   measure([&](uint64_t n)
+                   {
+                       uint64_t start = now_ns();
+                       for(uint64_t i = 0; i < n; i++)
+                       {
+                           sink = serial_frame_handler::buf2queue(frame, frame_len - 1, queue);
+                           queue.clear();
+                       }
+                       return now_ns() - start;
+                   }, frame_len - 1, commands));
+
+            /*
+             * Refilling the queue is not timed. The output buffers are large
+             * enough for every command to make it into the frame.
+             */
+            report(csv, label, "queue2buf", size, 0, mix.name, commands,
+                   measure([&](uint64_t n)
+                   {
+                       uint64_t total = 0;
+                       for(uint64_t i = 0; i < n; i++)
+                       {
+                           queue.push_n(commands_buf, commands);
+                           uint64_t start = now_ns();
+                           sink = serial_frame_handler::queue2buf(queue, created, sizeof(created));
+                           total += now_ns() - start;
+                           queue.clear();
+                       }
+                       return total;
+                   }, frame_len, commands));
+
+            report(csv, label, "queue2cobs", size, 0, mix.name, commands,
+                   measure([&](uint64_t n)
+                   {
+                       uint64_t total = 0;
+                       for(uint64_t i = 0; i < n; i++)
+                       {
+                           queue.push_n(commands_buf, commands);
+                           uint64_t start = now_ns();
+                           sink = serial_frame_handler::queue2cobs(queue, encoded, sizeof(encoded));
+                           total += now_ns() - start;
+                           queue.clear();
+                       }
+                       return total;
+                   }, frame_len, commands));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *label = "local";
+    const char *output = nullptr;
+    int opt;
+
+    while((opt = getopt(argc, argv, "r:t:l:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 't':
+                run_ms = atoi(optarg);
+                break;
+            case 'l':
+                label = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r runs] [-t ms per run] [-l label] [-o output.csv]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(runs < 1 || runs > 64 || run_ms < 1)
+    {
+        fprintf(stderr, "runs must be 1-64 and the run time at least 1 ms\n");
+        return 1;
+    }
+
+    FILE *csv = nullptr;
+    if(output != nullptr)
+    {
+        csv = fopen(output, "w");
+        if(csv == nullptr)
+        {
+            perror(output);
+            return 1;
+        }
+
+        fprintf(csv, "label,bench,size,zero_percent,payload_mix,commands,runs,"
+                     "ns_per_byte_min,ns_per_byte_median,ns_per_byte_max,"
+                     "commands_per_us\n");
+    }
+
+    /*
+     * A fixed seed keeps the data identical between runs and commits.
+     */
+    std::mt19937 rng(20191102);
+    bench_bytes(csv, label, rng);
+    bench_frames(csv, label, rng);
+
+    if(csv != nullptr)
+    {
+        fclose(csv);
+    }
+
+    return 0;
+}
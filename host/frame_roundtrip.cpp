@@ -0,0 +1,209 @@
+/*
+ * Round trip check of the v2 wire format for the host build. Frames of
+ * commands are built with queue2cobs, COBS decoded and parsed back with
+ * buf2queue, and every parsed command is compared with the one sent. The
+ * frames cover address steps in both directions, from the small steps packed
+ * into the command header to the largest varint deltas, every payload size
+ * packed into the header nibble, with and without per-command checksums, and
+ * command counts on both sides of the one byte varint boundary.
+ *
+ * Usage: frame_roundtrip [-f random frames per count]
+ */
+
+#include <random>
+#include <unistd.h>
+#include "vex.h"
+#include "cobs.h"
+#include "serial_frame.h"
+#include "spsc_ringbuffer.h"
+
+/*
+ * The largest encoded frame built, the transmit frame buffer of serial_port.
+ */
+constexpr size_t frame_cap = 4096;
+
+/*
+ * The command counts framed. 127 and 128 are the last one byte and the
+ * first two byte varint count.
+ */
+const size_t command_counts[] = { 0, 1, 7, 127, 128, 129, 255 };
+
+/*
+ * Addresses visited in order by the edge case frame. Consecutive addresses
+ * step by 0, by the small header steps 1 and 7, by 8, just past them, and
+ * backwards, including the largest steps of +0x3FFF and -0x4000 and steps
+ * that wrap around the 15 bit address space.
+ */
+const uint16_t edge_addresses[] =
+{
+    0x0000, 0x0000, 0x0001, 0x0008, 0x0010, 0x000F, 0x0000, 0x7FFF, 0x0000,
+    0x3FFF, 0x7FFF, 0x3FFF, 0x7FFE, 0x3FFE, 0x4000, 0x0000, 0x4000, 0x7F00,
+    0x0100, 0x00FF, 0x0107, 0x0100, 0x7FF9, 0x0001
+};
+
+typedef spsc_ringbuffer<serial_command, 512> frame_queue;
+
+/*
+ * Fills a command with random payload bytes.
+ */
+static void fill_payload(std::mt19937 &rng, serial_command &command, uint8_t size)
+{
+    command.payload_size = size;
+    for(size_t i = 0; i < size; i++)
+    {
+        command.data[i] = static_cast<uint8_t>(rng());
+    }
+}
+
+/*
+ * Builds one frame of the commands, parses it back and compares them.
+ *
+ * @param sent The commands in the frame.
+ * @param count The number of commands.
+ * @param format The wire format of the frame.
+ *
+ * @return True if every command survived the round trip.
+ */
+static bool round_trip(const serial_command *sent, size_t count,
+                       const serial_frame_handler::frame_format &format)
+{
+    static frame_queue outgoing;
+    static frame_queue parsed;
+    static uint8_t encoded[frame_cap];
+    static uint8_t decoded[frame_cap];
+
+    outgoing.clear();
+    parsed.clear();
+
+    for(size_t i = 0; i < count; i++)
+    {
+        outgoing.push(sent[i]);
+    }
+
+    abstract_queue<serial_command> *queues[1] = { &outgoing };
+    uint16_t framed = 0;
+    size_t encoded_len = serial_frame_handler::queue2cobs(queues, 1,
+                                                          encoded, sizeof(encoded),
+                                                          nullptr, 0,
+                                                          format,
+                                                          nullptr, nullptr, 0,
+                                                          &framed);
+    if(encoded_len == 0 || framed != count)
+    {
+        return false;
+    }
+
+    /*
+     * v2 frames end with the CRC, so only the delimiter is dropped.
+     */
+    size_t decoded_len = cobs::decode(encoded, encoded_len - 1, decoded);
+    if(!serial_frame_handler::is_v2(decoded) ||
+       serial_frame_handler::command_count(decoded, decoded_len) != count ||
+       !serial_frame_handler::buf2queue(decoded, decoded_len, parsed) ||
+       parsed.size() != count)
+    {
+        return false;
+    }
+
+    for(size_t i = 0; i < count; i++)
+    {
+        const serial_command &expected = sent[i];
+        const serial_command &command = parsed.peek(i);
+
+        if(command.address != expected.address ||
+           command.payload_size != expected.payload_size ||
+           memcmp(command.data, expected.data, expected.payload_size) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int random_frames = 200;
+    int opt;
+
+    while((opt = getopt(argc, argv, "f:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'f':
+                random_frames = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-f frames]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    std::mt19937 rng(1);
+    static serial_command sent[256];
+    uint32_t frames = 0;
+    uint32_t failures = 0;
+
+    for(bool checksums : { true, false })
+    {
+        serial_frame_handler::frame_format format = { 2, checksums, false };
+
+        /*
+         * The edge case frame, cycling through every payload size and
+         * setting the read flag on every third command.
+         */
+        size_t edge_count = sizeof(edge_addresses) / sizeof(edge_addresses[0]);
+        for(size_t i = 0; i < edge_count; i++)
+        {
+            sent[i].address = edge_addresses[i] | (i % 3 == 0 ? 0x8000 : 0);
+            fill_payload(rng, sent[i], static_cast<uint8_t>(i % (serial_command::MAX_COMMAND_LEN + 1)));
+        }
+
+        frames++;
+        if(!round_trip(sent, edge_count, format))
+        {
+            failures++;
+            printf("edge_frame_failed checksums %d\n", checksums);
+        }
+
+        /*
+         * Random frames of each count. Half of the address steps are small
+         * and half are anywhere in the address space.
+         */
+        std::uniform_int_distribution<int> small_step(-8, 8);
+        std::uniform_int_distribution<int> size(0, serial_command::MAX_COMMAND_LEN);
+
+        for(size_t count : command_counts)
+        {
+            for(int f = 0; f < random_frames; f++)
+            {
+                uint16_t address = static_cast<uint16_t>(rng() & 0x7FFF);
+                for(size_t i = 0; i < count; i++)
+                {
+                    address = (rng() & 1) ? static_cast<uint16_t>(rng())
+                                          : static_cast<uint16_t>(address + small_step(rng));
+                    sent[i].address = address & 0x7FFF;
+                    if(rng() & 1)
+                    {
+                        sent[i].address |= 0x8000;
+                    }
+
+                    fill_payload(rng, sent[i], static_cast<uint8_t>(size(rng)));
+                }
+
+                frames++;
+                if(!round_trip(sent, count, format))
+                {
+                    failures++;
+                    printf("random_frame_failed checksums %d commands %lu\n",
+                           checksums, static_cast<unsigned long>(count));
+                }
+            }
+        }
+    }
+
+    printf("frames %lu\n", static_cast<unsigned long>(frames));
+    printf("failures %lu\n", static_cast<unsigned long>(failures));
+
+    return failures == 0 ? 0 : 1;
+}
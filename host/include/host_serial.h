@@ -0,0 +1,16 @@
+/*
+ * Host only access to the pseudo-terminals backing the simulated smart
+ * ports.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Returns the path of the pseudo-terminal a peer opens to talk to a smart
+ * port, or null if the port has not been enabled yet.
+ *
+ * @param index The smart port index, 0 (Port 1) to 20 (Port 21).
+ */
+const char *host_serial_pty_name(uint32_t index);
@@ -0,0 +1,50 @@
+/*
+ * Host stand-in for the V5 SDK device API. Declares the subset of the C API
+ * the serial stack uses; host/src/host_devices.cpp implements it on Linux.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Handle of a smart port device.
+ */
+typedef void *V5_DeviceT;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+V5_DeviceT vexDeviceGetByIndex(uint32_t index);
+
+/*
+ * Generic serial. Each smart port is backed by a pseudo-terminal that is
+ * opened when the port is enabled.
+ */
+void vexDeviceGenericSerialEnable(V5_DeviceT device, int32_t options);
+void vexDeviceGenericSerialBaudrate(V5_DeviceT device, int32_t baudrate);
+int32_t vexDeviceGenericSerialReadChar(V5_DeviceT device);
+int32_t vexDeviceGenericSerialTransmit(V5_DeviceT device, uint8_t *buffer, int32_t length);
+int32_t vexDeviceGenericSerialReceive(V5_DeviceT device, uint8_t *buffer, int32_t length);
+int32_t vexDeviceGenericSerialReceiveAvail(V5_DeviceT device);
+int32_t vexDeviceGenericSerialWriteFree(V5_DeviceT device);
+void vexDeviceGenericSerialFlush(V5_DeviceT device);
+
+/*
+ * Sensors. The host returns slowly changing simulated values.
+ */
+double vexDeviceMotorPositionGet(V5_DeviceT device);
+double vexDeviceMotorVelocityGet(V5_DeviceT device);
+int32_t vexDeviceMotorCurrentGet(V5_DeviceT device);
+int32_t vexDeviceAdiValueGet(V5_DeviceT device, uint32_t port);
+double vexDeviceImuHeadingGet(V5_DeviceT device);
+
+/*
+ * System.
+ */
+uint64_t vexSystemHighResTimeGet(void);
+
+#ifdef __cplusplus
+}
+#endif
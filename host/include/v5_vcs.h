@@ -0,0 +1,80 @@
+/*
+ * Host stand-in for the VEXcode C++ classes. Declares the subset of the vex
+ * namespace the serial stack uses; host/src/host_vex.cpp implements it with
+ * std::thread, std::mutex and std::chrono.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+
+namespace vex
+{
+    /*
+     * A non-recursive mutex.
+     */
+    class mutex
+    {
+        public:
+
+        void lock();
+        void unlock();
+        bool try_lock();
+
+        private:
+
+        std::mutex m;
+    };
+
+    /*
+     * A detached thread running a callback. Copies of a task refer to no
+     * thread; the callback keeps running until it returns.
+     */
+    class task
+    {
+        public:
+
+        task();
+        task(int (*callback)(void));
+        task(int (*callback)(void *), void *arg);
+
+        static void sleep(uint32_t time);
+    };
+
+    /*
+     * The system timers, counted from program start.
+     */
+    class timer
+    {
+        public:
+
+        uint32_t system();
+        uint64_t systemHighResolution();
+    };
+
+    /*
+     * The brain. The screen prints nothing on the host.
+     */
+    class brain
+    {
+        public:
+
+        class lcd
+        {
+            public:
+
+            void printAt(int32_t x, int32_t y, const char *format, ...);
+        };
+
+        lcd Screen;
+        timer Timer;
+    };
+
+    namespace this_thread
+    {
+        void sleep_for(uint32_t time);
+        void sleep_until(uint32_t time);
+        void yield();
+    }
+}
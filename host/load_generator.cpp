@@ -0,0 +1,298 @@
+/*
+ * Master-side load generator for the host build. Runs a serial_thread on a
+ * simulated smart port, drives it over the port's pseudo-terminal with
+ * half-duplex v1 frames and reports throughput and latency.
+ *
+ * Usage: load_generator [-d seconds] [-n commands per frame] [-s payload size]
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "vex.h"
+#include "serial_thread.h"
+#include "latency_histogram.h"
+#include "host_serial.h"
+
+/*
+ * Smart port index of the simulated slave.
+ */
+constexpr int32_t port = 0;
+
+/*
+ * Baud rate of the simulated slave.
+ */
+constexpr int32_t baudrate = 921600;
+
+/*
+ * Time to wait for a reply frame before counting a timeout, in milliseconds.
+ */
+constexpr int reply_timeout = 100;
+
+/*
+ * The largest encoded frame handled.
+ */
+constexpr size_t frame_cap = 4096;
+
+/*
+ * A global instance of vex::brain.
+ */
+vex::brain brain;
+
+/*
+ * The slave under load.
+ */
+serial_thread slave;
+
+/*
+ * If the echo task keeps running.
+ */
+atomic_primitive<bool> echo_running(true);
+
+/*
+ * Thread function running the slave's serial routine.
+ */
+int slave_task()
+{
+    slave.serial_routine();
+    return 0;
+}
+
+/*
+ * Thread function standing in for the robot program: every command the
+ * slave receives is sent back in a later reply.
+ */
+int echo_task()
+{
+    while(echo_running.get_value())
+    {
+        serial_command command;
+        bool echoed = false;
+
+        while(slave.rx_queue().pop(command))
+        {
+            slave.send(command);
+            echoed = true;
+        }
+
+        if(!echoed)
+        {
+            vex::this_thread::sleep_for(1);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Reads from the pseudo-terminal until a frame delimiter arrives. Bytes
+ * after the delimiter are kept for the next frame.
+ *
+ * @param fd The pseudo-terminal.
+ * @param buf The buffer bytes are collected in.
+ * @param len The number of bytes in the buffer. Updated as bytes arrive.
+ * @param frame_len Set to the length of the frame, including the delimiter.
+ *
+ * @return True if a frame arrived before the timeout.
+ */
+static bool read_frame(int fd, uint8_t *buf, size_t &len, size_t &frame_len)
+{
+    while(true)
+    {
+        for(size_t i = 0; i < len; i++)
+        {
+            if(buf[i] == 0)
+            {
+                frame_len = i + 1;
+                return true;
+            }
+        }
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if(len == frame_cap || poll(&pfd, 1, reply_timeout) <= 0)
+        {
+            len = 0;
+            return false;
+        }
+
+        ssize_t received = read(fd, buf + len, frame_cap - len);
+        if(received > 0)
+        {
+            len += received;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = 5;
+    int commands = 8;
+    int payload = 4;
+    int opt;
+
+    while((opt = getopt(argc, argv, "d:n:s:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'd':
+                seconds = atoi(optarg);
+                break;
+            case 'n':
+                commands = atoi(optarg);
+                break;
+            case 's':
+                payload = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-d seconds] [-n commands] [-s payload]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(commands < 0 || commands > 255 ||
+       payload < 0 || payload > static_cast<int>(serial_command::MAX_COMMAND_LEN))
+    {
+        fprintf(stderr, "commands must be 0-255 and payload 0-%d\n",
+                static_cast<int>(serial_command::MAX_COMMAND_LEN));
+        return 1;
+    }
+
+    /*
+     * Start the slave and wait for its smart port to open.
+     */
+    slave.init(brain, port, baudrate, slave_task);
+    vex::task echo(echo_task);
+
+    const char *pty_name;
+    while((pty_name = host_serial_pty_name(port)) == nullptr)
+    {
+        vex::this_thread::sleep_for(1);
+    }
+
+    int fd = open(pty_name, O_RDWR | O_NOCTTY);
+    if(fd < 0)
+    {
+        perror(pty_name);
+        return 1;
+    }
+
+    struct termios attr;
+    tcgetattr(fd, &attr);
+    cfmakeraw(&attr);
+    tcsetattr(fd, TCSANOW, &attr);
+
+    /*
+     * Send frames one at a time and wait for each reply, as a half-duplex
+     * master does.
+     */
+    static uint8_t frame[frame_cap];
+    static uint8_t encoded[frame_cap];
+    static uint8_t rx_buf[frame_cap];
+    static uint8_t decoded[frame_cap];
+    spsc_ringbuffer<serial_command, 256> outgoing;
+    spsc_ringbuffer<serial_command, 1024> replies;
+    latency_histogram round_trip;
+
+    uint32_t frames = 0;
+    uint32_t timeouts = 0;
+    uint32_t bad_replies = 0;
+    uint32_t sent_commands = 0;
+    uint32_t echoed_commands = 0;
+    size_t rx_len = 0;
+    uint8_t counter = 0;
+
+    uint32_t start = brain.Timer.system();
+    uint32_t end = start + 1000 * seconds;
+
+    while(static_cast<int32_t>(brain.Timer.system() - end) < 0)
+    {
+        for(int i = 0; i < commands; i++)
+        {
+            serial_command command;
+            command.address = static_cast<uint16_t>(i);
+            command.payload_size = static_cast<uint8_t>(payload);
+            for(int j = 0; j < payload; j++)
+            {
+                command.data[j] = counter++;
+            }
+
+            outgoing.push(command);
+        }
+
+        /*
+         * queue2buf ends the frame with the trailing 0 of slave frames,
+         * which the master does not send.
+         */
+        size_t frame_len = serial_frame_handler::queue2buf(outgoing, frame, sizeof(frame));
+        size_t encoded_len = cobs::encode(frame, frame_len - 1, encoded);
+        encoded[encoded_len++] = 0;
+
+        uint32_t sent_us = static_cast<uint32_t>(brain.Timer.systemHighResolution());
+        if(write(fd, encoded, encoded_len) != static_cast<ssize_t>(encoded_len))
+        {
+            perror("write");
+            return 1;
+        }
+
+        sent_commands += commands;
+
+        size_t reply_len;
+        if(!read_frame(fd, rx_buf, rx_len, reply_len))
+        {
+            timeouts++;
+            continue;
+        }
+
+        round_trip.record(static_cast<uint32_t>(brain.Timer.systemHighResolution()) - sent_us);
+        frames++;
+
+        /*
+         * The reply ends with its delimiter and, inside the encoding, the
+         * trailing 0 after the CRC.
+         */
+        size_t decoded_len = cobs::decode(rx_buf, reply_len - 1, decoded);
+        if(decoded_len < 5 ||
+           !serial_frame_handler::buf2queue(decoded, decoded_len - 1, replies))
+        {
+            bad_replies++;
+        }
+
+        echoed_commands += replies.size();
+        replies.clear();
+
+        rx_len -= reply_len;
+        memmove(rx_buf, rx_buf + reply_len, rx_len);
+    }
+
+    double elapsed = (brain.Timer.system() - start) / 1000.0;
+
+    echo_running.set_value(false);
+    slave.destroy();
+    close(fd);
+
+    /*
+     * Report in "key value" lines so runs can be compared by script.
+     */
+    latency_histogram &turnaround = slave.latency(LATENCY_TURNAROUND);
+
+    printf("seconds %.3f\n", elapsed);
+    printf("commands_per_frame %d\n", commands);
+    printf("payload_size %d\n", payload);
+    printf("frames %lu\n", static_cast<unsigned long>(frames));
+    printf("frames_per_s %.1f\n", frames / elapsed);
+    printf("commands_per_s %.1f\n", sent_commands / elapsed);
+    printf("echoed_commands %lu\n", static_cast<unsigned long>(echoed_commands));
+    printf("timeouts %lu\n", static_cast<unsigned long>(timeouts));
+    printf("bad_replies %lu\n", static_cast<unsigned long>(bad_replies));
+    printf("round_trip_us_p50 %lu\n", static_cast<unsigned long>(round_trip.percentile(500)));
+    printf("round_trip_us_p99 %lu\n", static_cast<unsigned long>(round_trip.percentile(990)));
+    printf("round_trip_us_max %lu\n", static_cast<unsigned long>(round_trip.max()));
+    printf("turnaround_us_p50 %lu\n", static_cast<unsigned long>(turnaround.percentile(500)));
+    printf("turnaround_us_p99 %lu\n", static_cast<unsigned long>(turnaround.percentile(990)));
+    printf("turnaround_us_max %lu\n", static_cast<unsigned long>(turnaround.max()));
+    printf("slave_rx_errors %lu\n", static_cast<unsigned long>(slave.rx_errors()));
+    printf("slave_tx_errors %lu\n", static_cast<unsigned long>(slave.tx_errors()));
+
+    return 0;
+}
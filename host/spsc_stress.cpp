@@ -0,0 +1,302 @@
+/*
+ * Two-thread stress test of spsc_ringbuffer for the host build. A producer
+ * thread streams numbered commands through a small buffer to a consumer
+ * thread, which checks that every command arrives once, in order and
+ * intact. The buffer wraps around many times per run. Both the element
+ * interface (push and pop) and the zero-copy interface (reserve, commit,
+ * peek and consume) are exercised.
+ *
+ * Usage: spsc_stress [-n commands per test]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include "vex.h"
+#include "serial_frame.h"
+#include "spsc_ringbuffer.h"
+
+/*
+ * The capacity of the buffer under test. Small, so indices wrap often and
+ * the producer and consumer keep meeting at the full and empty boundaries.
+ */
+constexpr size_t capacity = 16;
+
+typedef spsc_ringbuffer<serial_command, capacity> stress_buffer;
+
+/*
+ * Time the consumer waits for the next command before counting the rest as
+ * lost, in milliseconds.
+ */
+constexpr int64_t stall_timeout = 1000;
+
+/*
+ * Set when the consumer gives up, so a producer blocked on a full buffer
+ * stops as well.
+ */
+static std::atomic<bool> abandoned(false);
+
+/*
+ * Tracks how long the consumer has waited for a command.
+ */
+class stall_timer
+{
+    public:
+
+        /*
+         * Restarts the wait, after a command arrived.
+         */
+        void reset()
+        {
+            start = std::chrono::steady_clock::now();
+        }
+
+        /*
+         * Returns if the wait exceeded stall_timeout. Gives up the test if
+         * so.
+         */
+        bool expired()
+        {
+            std::this_thread::yield();
+
+            if(std::chrono::steady_clock::now() - start <
+               std::chrono::milliseconds(stall_timeout))
+            {
+                return false;
+            }
+
+            abandoned.store(true);
+            return true;
+        }
+
+    private:
+
+        /*
+         * The time the wait started.
+         */
+        std::chrono::steady_clock::time_point start;
+};
+
+/*
+ * Fills a command with its sequence number, spread over the address and
+ * every payload byte so a torn copy is detected.
+ */
+static void make_command(uint64_t seq, serial_command &command)
+{
+    command.address = static_cast<uint16_t>(seq);
+    command.payload_size = serial_command::MAX_COMMAND_LEN;
+    for(size_t i = 0; i < serial_command::MAX_COMMAND_LEN; i++)
+    {
+        command.data[i] = static_cast<uint8_t>(seq >> (8 * i));
+    }
+}
+
+/*
+ * Checks that a command carries the expected sequence number.
+ *
+ * @return True if the command is intact and in order.
+ */
+static bool check_command(uint64_t seq, const serial_command &command)
+{
+    serial_command expected;
+    make_command(seq, expected);
+
+    return command.address == expected.address &&
+           command.payload_size == expected.payload_size &&
+           memcmp(command.data, expected.data, sizeof(expected.data)) == 0;
+}
+
+/*
+ * Producer of the element interface test.
+ */
+static void push_producer(stress_buffer *buffer, uint64_t count)
+{
+    serial_command command;
+
+    for(uint64_t seq = 0; seq < count; seq++)
+    {
+        make_command(seq, command);
+        while(!buffer->push(command))
+        {
+            if(abandoned.load())
+            {
+                return;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+}
+
+/*
+ * Consumer of the element interface test.
+ *
+ * @return The number of commands lost, duplicated, reordered or torn.
+ */
+static uint64_t pop_consumer(stress_buffer *buffer, uint64_t count)
+{
+    serial_command command;
+    stall_timer stall;
+    uint64_t errors = 0;
+
+    for(uint64_t seq = 0; seq < count; seq++)
+    {
+        stall.reset();
+        while(!buffer->pop(command))
+        {
+            if(stall.expired())
+            {
+                return errors + count - seq;
+            }
+        }
+
+        if(!check_command(seq, command))
+        {
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+/*
+ * Producer of the zero-copy interface test. Reservations have a random
+ * size, and some commit fewer slots than were reserved.
+ */
+static void reserve_producer(stress_buffer *buffer, uint64_t count)
+{
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<size_t> batch(1, capacity);
+    uint64_t seq = 0;
+
+    while(seq < count)
+    {
+        size_t n = batch(rng);
+        if(n > count - seq)
+        {
+            n = count - seq;
+        }
+
+        if(!buffer->reserve(n))
+        {
+            if(abandoned.load())
+            {
+                return;
+            }
+
+            std::this_thread::yield();
+            continue;
+        }
+
+        for(size_t i = 0; i < n; i++)
+        {
+            make_command(seq + i, buffer->reserved(i));
+        }
+
+        size_t committed = batch(rng) % 4 == 0 ? n / 2 + 1 : n;
+        buffer->commit(committed);
+        seq += committed;
+    }
+}
+
+/*
+ * Consumer of the zero-copy interface test. Reads a random number of the
+ * available commands in place before releasing them.
+ *
+ * @return The number of commands lost, duplicated, reordered or torn.
+ */
+static uint64_t peek_consumer(stress_buffer *buffer, uint64_t count)
+{
+    std::mt19937 rng(2);
+    stall_timer stall;
+    uint64_t errors = 0;
+    uint64_t seq = 0;
+
+    stall.reset();
+    while(seq < count)
+    {
+        size_t available = buffer->size();
+        if(available == 0)
+        {
+            if(stall.expired())
+            {
+                return errors + count - seq;
+            }
+
+            continue;
+        }
+
+        stall.reset();
+        size_t n = std::uniform_int_distribution<size_t>(1, available)(rng);
+        for(size_t i = 0; i < n; i++)
+        {
+            if(!check_command(seq + i, buffer->peek(i)))
+            {
+                errors++;
+            }
+        }
+
+        if(!buffer->consume(n))
+        {
+            errors++;
+        }
+
+        seq += n;
+    }
+
+    return errors;
+}
+
+/*
+ * Runs one test with a producer thread and a consumer on this thread.
+ *
+ * @return The number of errors found.
+ */
+static uint64_t run_test(const char *name,
+                         void (*producer)(stress_buffer *, uint64_t),
+                         uint64_t (*consumer)(stress_buffer *, uint64_t),
+                         uint64_t count)
+{
+    static stress_buffer buffer;
+    buffer.clear();
+    abandoned.store(false);
+
+    std::thread producer_thread(producer, &buffer, count);
+    uint64_t errors = consumer(&buffer, count);
+    producer_thread.join();
+
+    if(!buffer.empty())
+    {
+        errors++;
+    }
+
+    printf("%s_commands %llu\n", name, static_cast<unsigned long long>(count));
+    printf("%s_errors %llu\n", name, static_cast<unsigned long long>(errors));
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t count = 10000000;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                count = strtoull(optarg, nullptr, 10);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n commands]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    uint64_t errors = run_test("push_pop", push_producer, pop_consumer, count);
+    errors += run_test("reserve_peek", reserve_producer, peek_consumer, count);
+
+    return errors == 0 ? 0 : 1;
+}
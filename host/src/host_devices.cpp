@@ -0,0 +1,244 @@
+/*
+ * Host implementation of the V5 device API. Generic serial smart ports are
+ * backed by pseudo-terminals and sensors return simulated values.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <atomic>
+#include "v5.h"
+#include "host_serial.h"
+
+/*
+ * The number of smart ports.
+ */
+static const uint32_t PORT_COUNT = 21;
+
+/*
+ * The number of bytes reported free in a transmit buffer.
+ */
+static const int32_t WRITE_FREE = 4096;
+
+/*
+ * A simulated smart port.
+ */
+struct host_device
+{
+    /*
+     * The smart port index.
+     */
+    uint32_t index;
+
+    /*
+     * The master side of the pseudo-terminal, or -1 if not enabled. Set
+     * after pty_name, so a peer that sees it can read the name.
+     */
+    std::atomic<int> fd;
+
+    /*
+     * The path a peer opens to reach the port.
+     */
+    char pty_name[64];
+
+    /*
+     * The configured baud rate. A pseudo-terminal moves bytes at memory
+     * speed, so it is only recorded.
+     */
+    int32_t baudrate;
+};
+
+/*
+ * Every smart port.
+ */
+static host_device devices[PORT_COUNT];
+
+/*
+ * Gives every device its index and marks it not enabled.
+ */
+static bool init_devices()
+{
+    for(uint32_t i = 0; i < PORT_COUNT; i++)
+    {
+        devices[i].index = i;
+        devices[i].fd.store(-1);
+        devices[i].pty_name[0] = '\0';
+        devices[i].baudrate = 0;
+    }
+
+    return true;
+}
+
+/*
+ * If the devices have been initialized. Initialized before main runs.
+ */
+static const bool devices_ready = init_devices();
+
+/*
+ * Returns the device behind a handle.
+ */
+static host_device *device_of(V5_DeviceT device)
+{
+    return static_cast<host_device *>(device);
+}
+
+/*
+ * Returns the simulated time, in seconds.
+ */
+static double sim_time()
+{
+    return static_cast<double>(vexSystemHighResTimeGet()) / 1e6;
+}
+
+V5_DeviceT vexDeviceGetByIndex(uint32_t index)
+{
+    return index < PORT_COUNT ? &devices[index] : nullptr;
+}
+
+/*
+ * Opens the pseudo-terminal of a port in raw, non-blocking mode.
+ */
+void vexDeviceGenericSerialEnable(V5_DeviceT device, int32_t)
+{
+    host_device *dev = device_of(device);
+    if(dev == nullptr || dev->fd >= 0)
+    {
+        return;
+    }
+
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0 ||
+       ptsname_r(fd, dev->pty_name, sizeof(dev->pty_name)) != 0)
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+
+        return;
+    }
+
+    struct termios attr;
+    if(tcgetattr(fd, &attr) == 0)
+    {
+        cfmakeraw(&attr);
+        tcsetattr(fd, TCSANOW, &attr);
+    }
+
+    dev->fd.store(fd, std::memory_order_release);
+}
+
+void vexDeviceGenericSerialBaudrate(V5_DeviceT device, int32_t baudrate)
+{
+    host_device *dev = device_of(device);
+    if(dev != nullptr)
+    {
+        dev->baudrate = baudrate;
+    }
+}
+
+int32_t vexDeviceGenericSerialReadChar(V5_DeviceT device)
+{
+    uint8_t c;
+    return vexDeviceGenericSerialReceive(device, &c, 1) == 1 ? c : -1;
+}
+
+/*
+ * Writes as much of a buffer as the pseudo-terminal accepts.
+ */
+int32_t vexDeviceGenericSerialTransmit(V5_DeviceT device, uint8_t *buffer, int32_t length)
+{
+    host_device *dev = device_of(device);
+    if(dev == nullptr || dev->fd < 0)
+    {
+        return -1;
+    }
+
+    ssize_t written = write(dev->fd, buffer, length);
+    return written < 0 ? 0 : static_cast<int32_t>(written);
+}
+
+/*
+ * Reads the bytes that are available, without waiting. Reading fails with
+ * EIO while no peer has the pseudo-terminal open, which reads as no data.
+ */
+int32_t vexDeviceGenericSerialReceive(V5_DeviceT device, uint8_t *buffer, int32_t length)
+{
+    host_device *dev = device_of(device);
+    if(dev == nullptr || dev->fd < 0)
+    {
+        return -1;
+    }
+
+    ssize_t received = read(dev->fd, buffer, length);
+    return received < 0 ? 0 : static_cast<int32_t>(received);
+}
+
+int32_t vexDeviceGenericSerialReceiveAvail(V5_DeviceT device)
+{
+    host_device *dev = device_of(device);
+    int available = 0;
+
+    if(dev == nullptr || dev->fd < 0 || ioctl(dev->fd, FIONREAD, &available) != 0)
+    {
+        return 0;
+    }
+
+    return available;
+}
+
+int32_t vexDeviceGenericSerialWriteFree(V5_DeviceT device)
+{
+    host_device *dev = device_of(device);
+    return dev != nullptr && dev->fd >= 0 ? WRITE_FREE : 0;
+}
+
+void vexDeviceGenericSerialFlush(V5_DeviceT device)
+{
+    host_device *dev = device_of(device);
+    if(dev != nullptr && dev->fd >= 0)
+    {
+        tcflush(dev->fd, TCIOFLUSH);
+    }
+}
+
+double vexDeviceMotorPositionGet(V5_DeviceT device)
+{
+    return 360.0 * sim_time() + device_of(device)->index;
+}
+
+double vexDeviceMotorVelocityGet(V5_DeviceT)
+{
+    return 60.0;
+}
+
+int32_t vexDeviceMotorCurrentGet(V5_DeviceT)
+{
+    return 500 + static_cast<int32_t>(100.0 * sin(sim_time()));
+}
+
+int32_t vexDeviceAdiValueGet(V5_DeviceT, uint32_t port)
+{
+    return 2048 + static_cast<int32_t>(1000.0 * sin(sim_time() + port));
+}
+
+double vexDeviceImuHeadingGet(V5_DeviceT)
+{
+    return fmod(10.0 * sim_time(), 360.0);
+}
+
+const char *host_serial_pty_name(uint32_t index)
+{
+    if(index >= PORT_COUNT || !devices_ready ||
+       devices[index].fd.load(std::memory_order_acquire) < 0)
+    {
+        return nullptr;
+    }
+
+    return devices[index].pty_name;
+}
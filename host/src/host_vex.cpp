@@ -0,0 +1,116 @@
+/*
+ * Host implementation of the VEXcode C++ classes.
+ */
+
+#include <chrono>
+#include <thread>
+#include "v5.h"
+#include "v5_vcs.h"
+
+/*
+ * The time the system timers count from.
+ */
+static const std::chrono::steady_clock::time_point start_time =
+  std::chrono::steady_clock::now();
+
+/*
+ * Returns the time since program start, in microseconds.
+ */
+static uint64_t elapsed_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start_time).count();
+}
+
+/*
+ * Runs a task callback without an argument.
+ */
+static void run_callback(int (*callback)(void))
+{
+    callback();
+}
+
+/*
+ * Runs a task callback with an argument.
+ */
+static void run_callback_arg(int (*callback)(void *), void *arg)
+{
+    callback(arg);
+}
+
+void vex::mutex::lock()
+{
+    m.lock();
+}
+
+void vex::mutex::unlock()
+{
+    m.unlock();
+}
+
+bool vex::mutex::try_lock()
+{
+    return m.try_lock();
+}
+
+vex::task::task()
+{
+}
+
+vex::task::task(int (*callback)(void))
+{
+    std::thread(run_callback, callback).detach();
+}
+
+vex::task::task(int (*callback)(void *), void *arg)
+{
+    std::thread(run_callback_arg, callback, arg).detach();
+}
+
+void vex::task::sleep(uint32_t time)
+{
+    this_thread::sleep_for(time);
+}
+
+uint32_t vex::timer::system()
+{
+    return static_cast<uint32_t>(elapsed_us() / 1000);
+}
+
+uint64_t vex::timer::systemHighResolution()
+{
+    return elapsed_us();
+}
+
+void vex::brain::lcd::printAt(int32_t, int32_t, const char *, ...)
+{
+}
+
+void vex::this_thread::sleep_for(uint32_t time)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(time));
+}
+
+/*
+ * Sleeps until a system time, in milliseconds. Wraparound is handled the
+ * same way as by the serial routine.
+ */
+void vex::this_thread::sleep_until(uint32_t time)
+{
+    uint32_t now = static_cast<uint32_t>(elapsed_us() / 1000);
+
+    if(static_cast<int32_t>(time - now) > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(time - now));
+    }
+}
+
+void vex::this_thread::yield()
+{
+    std::this_thread::yield();
+}
+
+uint64_t vexSystemHighResTimeGet(void)
+{
+    return elapsed_us();
+}
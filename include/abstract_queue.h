@@ -7,10 +7,67 @@ template <typename T>
 class abstract_queue
 {
     public:
-        
+
     virtual bool push(const T &element) = 0;
     virtual bool pop(T &element) = 0;
 
+    /*
+     * Pushes n elements. Either every element is pushed or none are.
+     *
+     * @return True if all n elements were pushed.
+     */
+    virtual bool push_n(const T *elements, size_t n)
+    {
+        if(!reserve(n))
+        {
+            return false;
+        }
+
+        for(size_t i = 0; i < n; i++)
+        {
+            reserved(i) = elements[i];
+        }
+
+        return commit(n);
+    }
+
+    /*
+     * Reserves n slots at the back of the queue for the producer. The
+     * slots are filled through reserved() and become visible to the
+     * consumer only once commit() is called. Every successful reserve()
+     * must be followed by exactly one commit().
+     *
+     * @return True if n slots were reserved.
+     */
+    virtual bool reserve(size_t n) = 0;
+
+    /*
+     * Returns the i-th slot of the current reservation.
+     */
+    virtual T &reserved(size_t i) = 0;
+
+    /*
+     * Publishes the first n reserved slots and releases the rest of the
+     * reservation. Committing 0 slots abandons the reservation.
+     *
+     * @return True if the slots were published.
+     */
+    virtual bool commit(size_t n) = 0;
+
+    /*
+     * Returns the i-th element from the front of the queue without removing
+     * it. Only the consumer may call this and i must be less than size().
+     */
+    virtual T &peek(size_t i) = 0;
+
+    /*
+     * Removes n elements from the front of the queue after they have been
+     * read through peek().
+     *
+     * @return True if n elements were removed.
+     */
+    virtual bool consume(size_t n) = 0;
+
     virtual size_t size() = 0;
 
     virtual size_t capacity() = 0;
@@ -20,4 +77,4 @@ class abstract_queue
     virtual bool full() = 0;
 
     virtual bool clear() = 0;
-};
\ No newline at end of file
+};
@@ -1,20 +1,270 @@
 /*
  * A thread safe wrapper for a primitive.
- * 
+ *
  * @author John Sauer
  * @date 10/13/2019
  */
 
 #pragma once
 
+#include <atomic>
+#include <type_traits>
 #include "vex.h"
 #include "lockguard.h"
+#include "seqlock.h"
 
 /*
- * A thread safe primitive wrapper class
+ * Enum for the ways an atomic_primitive can store its value.
+ */
+enum atomic_storage
+{
+    /*
+     * A lock-free std::atomic, for trivially copyable types no larger than
+     * a machine word.
+     */
+    ATOMIC_LOCK_FREE,
+
+    /*
+     * A seqlock, for larger trivially copyable types. Reads never lock;
+     * writes are serialized by a mutex.
+     */
+    ATOMIC_SEQLOCK,
+
+    /*
+     * A mutex around every access, for every other type.
+     */
+    ATOMIC_MUTEX
+};
+
+/*
+ * Picks the storage of an atomic_primitive from the size and copyability of
+ * its type.
+ */
+template <class T>
+struct atomic_storage_of
+{
+    static constexpr atomic_storage value =
+      !__is_trivially_copyable(T) ? ATOMIC_MUTEX :
+      (sizeof(T) <= sizeof(void *) && (sizeof(T) & (sizeof(T) - 1)) == 0) ?
+        ATOMIC_LOCK_FREE : ATOMIC_SEQLOCK;
+};
+
+/*
+ * A thread safe primitive wrapper class. Every specialization has the same
+ * interface; only the cost of an access differs.
+ */
+template <class T, atomic_storage STORAGE = atomic_storage_of<T>::value>
+class atomic_primitive;
+
+/*
+ * A thread safe primitive wrapper backed by a lock-free std::atomic.
  */
 template <class T>
-class atomic_primitive
+class atomic_primitive<T, ATOMIC_LOCK_FREE>
+{
+    public:
+
+        /*
+         * Default constructor.
+         */
+        atomic_primitive()
+        {
+        }
+
+        /*
+         * Default destructor.
+         */
+        ~atomic_primitive()
+        {
+        }
+
+        /*
+         * Constructor with initial value.
+         */
+        atomic_primitive(const T& initial_val) :
+            val_(initial_val)
+        {
+        }
+
+        /*
+         * Set the value of the primitive.
+         *
+         * @param val The value the primitive is set to.
+         */
+        void set_value(const T& val)
+        {
+            val_.store(val, std::memory_order_release);
+        }
+
+        /*
+         * Get the value of the primitive.
+         *
+         * @return The value of the primitive.
+         */
+        T get_value()
+        {
+            return val_.load(std::memory_order_acquire);
+        }
+
+        /*
+         * Add to the value of the primitive in one atomic step.
+         *
+         * @param delta The amount added.
+         *
+         * @return The value before the addition.
+         */
+        T fetch_add(const T& delta)
+        {
+            return fetch_add(delta, std::integral_constant<bool,
+                               std::is_integral<T>::value &&
+                               !std::is_same<T, bool>::value>());
+        }
+
+        /*
+         * Replace the value of the primitive in one atomic step.
+         *
+         * @param val The value the primitive is set to.
+         *
+         * @return The value before the replacement.
+         */
+        T exchange(const T& val)
+        {
+            return val_.exchange(val, std::memory_order_acq_rel);
+        }
+
+    private:
+
+        /*
+         * Integral types other than bool have a native atomic addition.
+         */
+        T fetch_add(const T& delta, std::true_type)
+        {
+            return val_.fetch_add(delta, std::memory_order_acq_rel);
+        }
+
+        /*
+         * Other types, such as float or enums, add in a compare and swap
+         * loop.
+         */
+        T fetch_add(const T& delta, std::false_type)
+        {
+            T old_val = val_.load(std::memory_order_relaxed);
+            while(!val_.compare_exchange_weak(old_val,
+                                              static_cast<T>(old_val + delta),
+                                              std::memory_order_acq_rel,
+                                              std::memory_order_relaxed))
+            {
+            }
+
+            return old_val;
+        }
+
+        /*
+         * The internal primitive storing data.
+         */
+        std::atomic<T> val_;
+};
+
+/*
+ * A thread safe primitive wrapper backed by a seqlock. Readers copy the
+ * value without locking and retry if a write overlapped the copy.
+ */
+template <class T>
+class atomic_primitive<T, ATOMIC_SEQLOCK>
+{
+    public:
+
+        /*
+         * Default constructor.
+         */
+        atomic_primitive()
+        {
+        }
+
+        /*
+         * Default destructor.
+         */
+        ~atomic_primitive()
+        {
+        }
+
+        /*
+         * Constructor with initial value.
+         */
+        atomic_primitive(const T& initial_val)
+        {
+            val_.store(initial_val);
+        }
+
+        /*
+         * Set the value of the primitive.
+         *
+         * @param val The value the primitive is set to.
+         */
+        void set_value(const T& val)
+        {
+            lockguard lock(m);
+            val_.store(val);
+        }
+
+        /*
+         * Get the value of the primitive.
+         *
+         * @return The value of the primitive.
+         */
+        T get_value()
+        {
+            return val_.load();
+        }
+
+        /*
+         * Add to the value of the primitive in one atomic step.
+         *
+         * @param delta The amount added.
+         *
+         * @return The value before the addition.
+         */
+        T fetch_add(const T& delta)
+        {
+            lockguard lock(m);
+            T old_val = val_.load();
+            val_.store(old_val + delta);
+            return old_val;
+        }
+
+        /*
+         * Replace the value of the primitive in one atomic step.
+         *
+         * @param val The value the primitive is set to.
+         *
+         * @return The value before the replacement.
+         */
+        T exchange(const T& val)
+        {
+            lockguard lock(m);
+            T old_val = val_.load();
+            val_.store(val);
+            return old_val;
+        }
+
+    private:
+
+        /*
+         * The mutex serializing writers. The seqlock allows only one.
+         */
+        vex::mutex m;
+
+        /*
+         * The internal primitive storing data.
+         */
+        seqlock<T> val_;
+};
+
+/*
+ * A thread safe primitive wrapper that locks a mutex for every access.
+ */
+template <class T>
+class atomic_primitive<T, ATOMIC_MUTEX>
 {
     public:
 
@@ -64,6 +314,36 @@ class atomic_primitive
             return temp;
         }
 
+        /*
+         * Add to the value of the primitive in one atomic step.
+         *
+         * @param delta The amount added.
+         *
+         * @return The value before the addition.
+         */
+        T fetch_add(const T& delta)
+        {
+            lockguard lock(m);
+            T temp = val_;
+            val_ = val_ + delta;
+            return temp;
+        }
+
+        /*
+         * Replace the value of the primitive in one atomic step.
+         *
+         * @param val The value the primitive is set to.
+         *
+         * @return The value before the replacement.
+         */
+        T exchange(const T& val)
+        {
+            lockguard lock(m);
+            T temp = val_;
+            val_ = val;
+            return temp;
+        }
+
     private:
 
         /*
@@ -76,4 +356,4 @@ class atomic_primitive
          * The internal primitive storing data.
          */
         T val_;
-};
\ No newline at end of file
+};
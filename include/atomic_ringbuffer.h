@@ -11,7 +11,8 @@ class atomic_ringbuffer : public abstract_queue<T>
     atomic_ringbuffer<T, CAPACITY>() :
         head_ptr(0),
         tail_ptr(0),
-        size_(0)
+        size_(0),
+        reserved_(0)
     {
     }
 
@@ -67,6 +68,68 @@ class atomic_ringbuffer : public abstract_queue<T>
         return false;
     }
 
+    /*
+     * Producers never write occupied slots, so the returned reference stays
+     * valid for the consumer after the lock is released.
+     */
+    T &peek(size_t i) override
+    {
+        lockguard lock(m);
+        return buffer[(head_ptr + i) % CAPACITY];
+    }
+
+    bool consume(size_t n) override
+    {
+        lockguard lock(m);
+
+        if(n > size_)
+        {
+            return false;
+        }
+
+        head_ptr = (head_ptr + n) % CAPACITY;
+        size_ -= n;
+        return true;
+    }
+
+    /*
+     * The mutex stays locked from a successful reserve until the matching
+     * commit, so the whole batch is published under one lock.
+     */
+    bool reserve(size_t n) override
+    {
+        m.lock();
+
+        if(CAPACITY - size_ < n)
+        {
+            m.unlock();
+            return false;
+        }
+
+        reserved_ = n;
+        return true;
+    }
+
+    T &reserved(size_t i) override
+    {
+        return buffer[(tail_ptr + i) % CAPACITY];
+    }
+
+    bool commit(size_t n) override
+    {
+        bool valid = n <= reserved_;
+
+        if(valid)
+        {
+            tail_ptr = (tail_ptr + n) % CAPACITY;
+            size_ += n;
+        }
+
+        reserved_ = 0;
+        m.unlock();
+        return valid;
+    }
+
     bool clear() override
     {
         lockguard lock(m);
@@ -82,4 +145,5 @@ class atomic_ringbuffer : public abstract_queue<T>
     size_t head_ptr;
     size_t tail_ptr;
     size_t size_;
+    size_t reserved_;
 };
\ No newline at end of file
@@ -0,0 +1,355 @@
+/*
+ * A serial command queue that keeps only the latest pending write to each
+ * address.
+ */
+
+#pragma once
+
+#include "vex.h"
+#include "abstract_queue.h"
+#include "lockguard.h"
+#include "serial_frame.h"
+
+/*
+ * A thread safe queue of serial commands in which a write to an address that
+ * already has a pending write replaces the pending command in place instead
+ * of being appended. Pending writes keep the position of the first write, so
+ * commands to different addresses stay in arrival order, and the number of
+ * queued writes is bounded by the number of distinct addresses instead of
+ * the arrival rate. Read requests are never coalesced.
+ *
+ * Pending writes are found through an open addressing index from address to
+ * queue position. Index entries are never deleted; an entry is simply stale
+ * once its position has left the queue. If every probed entry is live, the
+ * entry at the home slot is replaced, so the newest write to an address is
+ * always indexed and at worst some writes to another address stop
+ * coalescing until it is written again.
+ *
+ * Once the consumer has peeked at a command, that command is frozen until
+ * it is consumed so a write is never lost by landing in a command that has
+ * already been serialized.
+ *
+ * CAPACITY must be a power of two.
+ */
+template <size_t CAPACITY>
+class coalescing_queue : public abstract_queue<serial_command>
+{
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0,
+                  "coalescing_queue CAPACITY must be a power of two");
+
+    /*
+     * Mask applied to a free running index to get a buffer position.
+     */
+    static constexpr size_t MASK = CAPACITY - 1;
+
+    /*
+     * The number of index entries. Twice the capacity keeps probe sequences
+     * short.
+     */
+    static constexpr size_t INDEX_SIZE = 2 * CAPACITY;
+
+    /*
+     * The number of index entries probed for an address.
+     */
+    static constexpr size_t PROBE_LIMIT = 8;
+
+    public:
+    coalescing_queue<CAPACITY>() :
+        head_ptr(0),
+        tail_ptr(0),
+        peeked_(0),
+        reserved_(0)
+    {
+        for(size_t i = 0; i < INDEX_SIZE; i++)
+        {
+            index[i] = 0;
+        }
+    }
+
+    ~coalescing_queue<CAPACITY>()
+    {
+    }
+
+    size_t size() override
+    {
+        lockguard lock(m);
+        return tail_ptr - head_ptr;
+    }
+
+    bool empty() override
+    {
+        return size() == 0;
+    }
+
+    bool full() override
+    {
+        return size() == CAPACITY;
+    }
+
+    size_t capacity() override
+    {
+        return CAPACITY;
+    }
+
+    bool push(const serial_command &element) override
+    {
+        lockguard lock(m);
+
+        if(tail_ptr - head_ptr == CAPACITY && element.is_read())
+        {
+            return false;
+        }
+
+        /*
+         * A full queue still accepts writes that coalesce.
+         */
+        if(tail_ptr - head_ptr == CAPACITY)
+        {
+            size_t *entry = find(element.address, tail_ptr);
+            if(entry == nullptr)
+            {
+                return false;
+            }
+
+            buffer[*entry & MASK] = element;
+            return true;
+        }
+
+        buffer[tail_ptr & MASK] = element;
+        tail_ptr = insert(tail_ptr);
+        return true;
+    }
+
+    bool pop(serial_command &element) override
+    {
+        lockguard lock(m);
+
+        if(tail_ptr == head_ptr)
+        {
+            return false;
+        }
+
+        element = buffer[head_ptr & MASK];
+        release(1);
+        return true;
+    }
+
+    /*
+     * The command stays frozen until it is consumed, so the returned
+     * reference stays valid for the consumer after the lock is released.
+     */
+    serial_command &peek(size_t i) override
+    {
+        lockguard lock(m);
+
+        if(i + 1 > peeked_)
+        {
+            peeked_ = i + 1;
+        }
+
+        return buffer[(head_ptr + i) & MASK];
+    }
+
+    bool consume(size_t n) override
+    {
+        lockguard lock(m);
+
+        if(n > tail_ptr - head_ptr)
+        {
+            return false;
+        }
+
+        release(n);
+        return true;
+    }
+
+    /*
+     * The mutex stays locked from a successful reserve until the matching
+     * commit, so the whole batch is coalesced and published under one lock.
+     * Room is reserved for every command even though some may coalesce.
+     */
+    bool reserve(size_t n) override
+    {
+        m.lock();
+
+        if(CAPACITY - (tail_ptr - head_ptr) < n)
+        {
+            m.unlock();
+            return false;
+        }
+
+        reserved_ = n;
+        return true;
+    }
+
+    serial_command &reserved(size_t i) override
+    {
+        return buffer[(tail_ptr + i) & MASK];
+    }
+
+    /*
+     * Coalesces each reserved command into a pending write to its address,
+     * including earlier commands of the same batch, or else packs it behind
+     * the commands kept so far.
+     */
+    bool commit(size_t n) override
+    {
+        bool valid = n <= reserved_;
+
+        if(valid)
+        {
+            size_t start = tail_ptr;
+
+            for(size_t i = 0; i < n; i++)
+            {
+                serial_command &command = buffer[(start + i) & MASK];
+
+                if(!command.is_read())
+                {
+                    size_t *entry = find(command.address, tail_ptr);
+                    if(entry != nullptr)
+                    {
+                        buffer[*entry & MASK] = command;
+                        continue;
+                    }
+                }
+
+                if(tail_ptr != start + i)
+                {
+                    buffer[tail_ptr & MASK] = command;
+                }
+
+                tail_ptr = insert(tail_ptr);
+            }
+        }
+
+        reserved_ = 0;
+        m.unlock();
+        return valid;
+    }
+
+    bool clear() override
+    {
+        lockguard lock(m);
+        head_ptr = tail_ptr;
+        peeked_ = 0;
+        return true;
+    }
+
+    private:
+
+    /*
+     * Returns the home index entry of an address.
+     */
+    static size_t home(uint16_t address)
+    {
+        return static_cast<size_t>((address * 2654435761u) >> 16) & (INDEX_SIZE - 1);
+    }
+
+    /*
+     * Returns true if a position holds a command that can still be
+     * overwritten: it is in the queue and the consumer has not peeked at it.
+     *
+     * @param pos The free running position.
+     * @param end The free running index one past the last queued command.
+     */
+    bool writable(size_t pos, size_t end)
+    {
+        return pos - (head_ptr + peeked_) < end - (head_ptr + peeked_);
+    }
+
+    /*
+     * Finds the index entry of the pending write to an address.
+     *
+     * @param address The address of the write.
+     * @param end The free running index one past the last queued command.
+     * @return The index entry, or nullptr if there is no writable pending
+     * write to the address.
+     */
+    size_t *find(uint16_t address, size_t end)
+    {
+        size_t slot = home(address);
+
+        for(size_t i = 0; i < PROBE_LIMIT; i++)
+        {
+            size_t *entry = &index[(slot + i) & (INDEX_SIZE - 1)];
+            serial_command &pending = buffer[*entry & MASK];
+
+            if(writable(*entry, end) &&
+               !pending.is_read() &&
+               pending.address == address)
+            {
+                return entry;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /*
+     * Indexes the command at the back of the queue and appends it.
+     *
+     * @param pos The free running position of the command, which is the
+     * current tail index.
+     * @return The new free running tail index.
+     */
+    size_t insert(size_t pos)
+    {
+        serial_command &command = buffer[pos & MASK];
+
+        if(!command.is_read())
+        {
+            size_t slot = home(command.address);
+            size_t *target = &index[slot];
+
+            for(size_t i = 0; i < PROBE_LIMIT; i++)
+            {
+                size_t *entry = &index[(slot + i) & (INDEX_SIZE - 1)];
+
+                if(!writable(*entry, pos))
+                {
+                    target = entry;
+                    break;
+                }
+            }
+
+            *target = pos;
+        }
+
+        return pos + 1;
+    }
+
+    /*
+     * Removes n commands from the front of the queue.
+     */
+    void release(size_t n)
+    {
+        head_ptr += n;
+        peeked_ = n < peeked_ ? peeked_ - n : 0;
+    }
+
+    vex::mutex m;
+    serial_command buffer[CAPACITY];
+
+    /*
+     * Free running queue positions of pending writes.
+     */
+    size_t index[INDEX_SIZE];
+
+    /*
+     * Free running index of the next command to pop.
+     */
+    size_t head_ptr;
+
+    /*
+     * Free running index of the next free slot.
+     */
+    size_t tail_ptr;
+
+    /*
+     * The number of commands at the front the consumer has peeked at.
+     */
+    size_t peeked_;
+
+    size_t reserved_;
+};
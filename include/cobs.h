@@ -21,4 +21,120 @@ namespace cobs
                   uint8_t* decoded_buffer);
 
     size_t encoded_buffer_size(size_t unencoded_buffer_size);
+
+    /*
+     * Incremental COBS encoder that consumes a message in pieces and writes
+     * the encoded frame, including the trailing delimiter, straight into the
+     * output buffer.
+     */
+    class encoder
+    {
+        public:
+
+        encoder();
+
+        void reset(uint8_t* encoded_buffer, size_t capacity);
+
+        void put(const uint8_t* buffer, size_t size);
+
+        size_t finish();
+
+        private:
+
+        /*
+         * The buffer receiving encoded bytes.
+         */
+        uint8_t* encoded_buffer_;
+
+        /*
+         * The capacity of the encoded buffer.
+         */
+        size_t capacity_;
+
+        /*
+         * The index the next data byte is written to.
+         */
+        size_t write_index_;
+
+        /*
+         * The index of the code byte of the current block.
+         */
+        size_t code_index_;
+
+        /*
+         * The number of data bytes in the current block.
+         */
+        size_t block_len_;
+
+        /*
+         * If the encoded frame did not fit in the encoded buffer.
+         */
+        bool overflow_;
+    };
+
+    /*
+     * Result of feeding a byte to a streaming decoder.
+     */
+    enum decode_status
+    {
+        DECODE_PENDING,
+        DECODE_COMPLETE,
+        DECODE_ERROR,
+        DECODE_OVERFLOW
+    };
+
+    /*
+     * Incremental COBS decoder that consumes an encoded frame one byte at a
+     * time. Decoded bytes are written to the output buffer as soon as they
+     * are known, so the decoded frame is complete when the delimiter arrives.
+     */
+    class decoder
+    {
+        public:
+
+        decoder();
+
+        void reset(uint8_t* decoded_buffer, size_t capacity);
+
+        decode_status feed(uint8_t encoded_byte);
+
+        decode_status feed(const uint8_t* encoded_buffer,
+                           size_t size,
+                           size_t& consumed);
+
+        size_t size();
+
+        private:
+
+        /*
+         * The buffer receiving decoded bytes.
+         */
+        uint8_t* decoded_buffer_;
+
+        /*
+         * The capacity of the decoded buffer.
+         */
+        size_t capacity_;
+
+        /*
+         * The number of decoded bytes written so far.
+         */
+        size_t size_;
+
+        /*
+         * The number of data bytes left in the current block. When this is
+         * 0 the next nonzero byte is a code byte.
+         */
+        uint8_t block_remaining_;
+
+        /*
+         * If a zero must be emitted before the next block.
+         */
+        bool is_zero_;
+
+        /*
+         * If at least one code byte has been consumed.
+         */
+        bool started_;
+    };
 };
\ No newline at end of file
@@ -0,0 +1,132 @@
+/*
+ * Contains the table that routes received serial commands to handlers by
+ * address.
+ */
+
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+#include "abstract_queue.h"
+
+struct serial_command;
+
+/*
+ * A function that handles a received serial command. Handlers run inline in
+ * the serial task once the frame containing the command has been verified,
+ * so they must not block and must not use the receive queue.
+ *
+ * @param command The received command. A handler may modify it.
+ * @param context The context pointer given when the handler was registered.
+ * @return True if the command was handled and should not be placed into the
+ * receive queue.
+ */
+typedef bool (*command_handler)(serial_command &command, void *context);
+
+/*
+ * A function that supplies the value answered to a read request. Sources run
+ * inline in the serial task while the request's frame is parsed, and their
+ * reply is sent in the next transmitted frame, so they must not block.
+ *
+ * @param reply The reply, with its address already set to the address of the
+ * read request and an empty payload. The source fills in the payload and
+ * payload size.
+ * @param context The context pointer given when the source was registered.
+ * @return True if a reply was produced. Otherwise the read request is placed
+ * into the receive queue.
+ */
+typedef bool (*value_source)(serial_command &reply, void *context);
+
+/*
+ * A dense two level table mapping every 16 bit command address, including
+ * the read flag in the Msb, to a handler. The high byte of the address
+ * selects a page and the low byte selects the handler within it, so a
+ * lookup is two array reads regardless of how many handlers are registered.
+ * Pages are only allocated for address blocks that have a handler, which
+ * keeps the table a few kilobytes instead of one entry per address.
+ *
+ * Handlers and value sources must be registered before the serial task
+ * starts.
+ */
+class command_dispatcher
+{
+    /*
+     * The number of 256 address pages that may have handlers.
+     */
+    static constexpr size_t MAX_PAGES = 16;
+
+    /*
+     * The number of distinct handler and context pairs. Index 0 is reserved
+     * for unhandled addresses.
+     */
+    static constexpr size_t MAX_HANDLERS = 255;
+
+    public:
+
+    command_dispatcher();
+
+    /*
+     * Running in main thread.
+     */
+    bool add(uint16_t address, bool read, command_handler handler, void *context);
+    bool add_range(uint16_t first,
+                   uint16_t last,
+                   bool read,
+                   command_handler handler,
+                   void *context);
+    bool add_source(uint16_t address, value_source source, void *context);
+    bool add_source_range(uint16_t first,
+                          uint16_t last,
+                          value_source source,
+                          void *context);
+
+    /*
+     * Running in the serial task.
+     */
+    bool dispatch(serial_command &command,
+                  abstract_queue<serial_command> *replies = nullptr);
+
+    private:
+
+    /*
+     * A registered handler or value source and its context. Exactly one of
+     * handler and source is set.
+     */
+    struct handler_entry
+    {
+        command_handler handler;
+        value_source source;
+        void *context;
+    };
+
+    bool add_entry(uint16_t first, uint16_t last, bool read,
+                   const handler_entry &entry);
+    uint8_t handler_index(const handler_entry &entry);
+    uint8_t *page(uint8_t page_num);
+
+    /*
+     * Index into pages plus one for every high address byte, or 0 if no
+     * address in that block has a handler.
+     */
+    uint8_t page_index[256];
+
+    /*
+     * Index into handlers for every low address byte of an allocated page.
+     */
+    uint8_t pages[MAX_PAGES][256];
+
+    /*
+     * The number of allocated pages.
+     */
+    size_t page_count;
+
+    /*
+     * The registered handlers. Entry 0 is unused.
+     */
+    handler_entry handlers[MAX_HANDLERS + 1];
+
+    /*
+     * The number of registered handlers, including the unused entry 0.
+     */
+    size_t handler_count;
+};
@@ -0,0 +1,76 @@
+/*
+ * A log bucketed histogram of latencies.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+
+/*
+ * Counts latencies, in microseconds, in buckets whose width grows with the
+ * value, like an HDR histogram. Values below SUB_BUCKETS get a bucket each;
+ * above that every power of two is split into SUB_BUCKETS buckets, so a
+ * reported percentile is never off by more than 1 / SUB_BUCKETS.
+ *
+ * One thread records and any thread may read. The counters are relaxed
+ * atomics, so a reader sees every bucket whole but the buckets of a
+ * snapshot may disagree by the values recorded while it was taken.
+ */
+class latency_histogram
+{
+    /*
+     * log2 of the number of buckets per power of two.
+     */
+    static constexpr uint32_t SUB_BUCKET_BITS = 3;
+
+    /*
+     * The number of buckets per power of two.
+     */
+    static constexpr uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+    public:
+
+    /*
+     * The number of buckets, covering every 32 bit value.
+     */
+    static constexpr size_t BUCKETS = (32 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    latency_histogram();
+
+    /*
+     * Running in the recording thread.
+     */
+    void record(uint32_t value);
+    void reset();
+
+    /*
+     * Running in any thread.
+     */
+    uint32_t count();
+    uint32_t max();
+    uint32_t percentile(uint32_t per_mille);
+    uint32_t bucket(size_t index);
+    int format(char *buf, size_t len);
+
+    static size_t bucket_index(uint32_t value);
+    static uint32_t bucket_floor(size_t index);
+
+    private:
+
+    /*
+     * The number of values recorded in each bucket.
+     */
+    std::atomic<uint32_t> buckets[BUCKETS];
+
+    /*
+     * The number of values recorded.
+     */
+    std::atomic<uint32_t> count_;
+
+    /*
+     * The largest value recorded.
+     */
+    std::atomic<uint32_t> max_;
+};
@@ -0,0 +1,368 @@
+/*
+ * A serial command queue with priority classes.
+ */
+
+#pragma once
+
+#include "abstract_queue.h"
+#include "spsc_ringbuffer.h"
+#include "serial_frame.h"
+
+/*
+ * A function that assigns a serial command to a priority class.
+ *
+ * @param command The command being queued.
+ * @param context The context pointer given with the classifier.
+ * @return The priority class, where 0 is the most urgent. Values past the
+ * last class are placed into the last class.
+ */
+typedef size_t (*command_classifier)(const serial_command &command,
+                                     void *context);
+
+/*
+ * A lock-free single-producer/single-consumer queue of serial commands split
+ * into LEVELS priority classes, each with its own ring buffer.
+ *
+ * The consumer sees the commands in a per-frame order: first up to the quota
+ * of every class, most urgent class first, and then whatever is left of each
+ * class in the same order. The order is fixed when the consumer first peeks
+ * and is recomputed after every consume, so every frame built with
+ * peek/consume starts with the most urgent commands, while the quotas keep a
+ * busy urgent class from starving the others.
+ *
+ * Commands are classified by the producer. Reserved commands are staged and
+ * only classified when they are committed.
+ *
+ * LEVEL_CAPACITY must be a power of two.
+ */
+template <size_t LEVELS, size_t LEVEL_CAPACITY>
+class multilevel_queue : public abstract_queue<serial_command>
+{
+    static_assert(LEVELS > 0, "multilevel_queue needs at least one level");
+    static_assert(LEVEL_CAPACITY > 0 &&
+                  (LEVEL_CAPACITY & (LEVEL_CAPACITY - 1)) == 0,
+                  "multilevel_queue LEVEL_CAPACITY must be a power of two");
+
+    public:
+    multilevel_queue<LEVELS, LEVEL_CAPACITY>() :
+        classifier(nullptr),
+        classifier_context(nullptr),
+        plan_valid(false),
+        plan_size(0),
+        plan_segments(0),
+        reserved_(0)
+    {
+        for(size_t i = 0; i < LEVELS; i++)
+        {
+            quota[i] = LEVEL_CAPACITY;
+        }
+    }
+
+    ~multilevel_queue<LEVELS, LEVEL_CAPACITY>()
+    {
+    }
+
+    /*
+     * Sets the function that assigns commands to classes. Without one every
+     * command goes into the last class. This must be called before the
+     * queue is used.
+     */
+    void set_classifier(command_classifier fn, void *context)
+    {
+        classifier = fn;
+        classifier_context = context;
+    }
+
+    /*
+     * Sets how many commands of a class come before any command of a less
+     * urgent class in each frame. This must be called before the queue is
+     * used.
+     */
+    void set_quota(size_t level, size_t n)
+    {
+        if(level < LEVELS)
+        {
+            quota[level] = n;
+        }
+    }
+
+    /*
+     * Returns the number of commands queued in one class.
+     */
+    size_t level_size(size_t level)
+    {
+        return level < LEVELS ? levels[level].size() : 0;
+    }
+
+    size_t size() override
+    {
+        size_t n = 0;
+        for(size_t i = 0; i < LEVELS; i++)
+        {
+            n += levels[i].size();
+        }
+
+        return n;
+    }
+
+    bool empty() override
+    {
+        return size() == 0;
+    }
+
+    /*
+     * True if any class is full, since the next push might then fail.
+     */
+    bool full() override
+    {
+        for(size_t i = 0; i < LEVELS; i++)
+        {
+            if(levels[i].full())
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    size_t capacity() override
+    {
+        return LEVELS * LEVEL_CAPACITY;
+    }
+
+    /*
+     * Producer side.
+     */
+    bool push(const serial_command &element) override
+    {
+        return levels[classify(element)].push(element);
+    }
+
+    /*
+     * Consumer side. Pops the first command in priority order. A pop is a
+     * peek/consume sequence of its own, so it starts from a fresh order.
+     */
+    bool pop(serial_command &element) override
+    {
+        make_plan();
+        if(plan_size == 0)
+        {
+            return false;
+        }
+
+        element = peek(0);
+        return consume(1);
+    }
+
+    /*
+     * Consumer side. The order is fixed by the first peek after a consume, so
+     * every peek/consume sequence must end with a consume, even of 0
+     * commands. The order never changes within a sequence: commands queued
+     * after it was fixed are not visible, and peeking past its end returns
+     * its last command.
+     */
+    serial_command &peek(size_t i) override
+    {
+        if(!plan_valid)
+        {
+            make_plan();
+        }
+
+        if(i >= plan_size && plan_size > 0)
+        {
+            i = plan_size - 1;
+        }
+
+        size_t s = 0;
+        while(s + 1 < plan_segments && i >= segments[s].count)
+        {
+            i -= segments[s].count;
+            s++;
+        }
+
+        return levels[segments[s].level].peek(segments[s].offset + i);
+    }
+
+    /*
+     * Consumer side. Removes the first n commands in priority order.
+     */
+    bool consume(size_t n) override
+    {
+        if(!plan_valid)
+        {
+            make_plan();
+        }
+
+        if(n > plan_size)
+        {
+            return false;
+        }
+
+        for(size_t s = 0; s < plan_segments && n > 0; s++)
+        {
+            size_t k = n < segments[s].count ? n : segments[s].count;
+            levels[segments[s].level].consume(k);
+            n -= k;
+        }
+
+        plan_valid = false;
+        return true;
+    }
+
+    /*
+     * Producer side. Room for n commands is required in every class since
+     * the classes of the reserved commands are not known yet.
+     */
+    bool reserve(size_t n) override
+    {
+        if(n > LEVEL_CAPACITY)
+        {
+            return false;
+        }
+
+        for(size_t i = 0; i < LEVELS; i++)
+        {
+            if(LEVEL_CAPACITY - levels[i].size() < n)
+            {
+                return false;
+            }
+        }
+
+        reserved_ = n;
+        return true;
+    }
+
+    serial_command &reserved(size_t i) override
+    {
+        return staging[i];
+    }
+
+    bool commit(size_t n) override
+    {
+        bool valid = n <= reserved_;
+
+        /*
+         * reserve made room for every command in any class, so a push only
+         * fails if the producer committed without a reservation.
+         */
+        for(size_t i = 0; valid && i < n; i++)
+        {
+            valid = levels[classify(staging[i])].push(staging[i]);
+        }
+
+        reserved_ = 0;
+        return valid;
+    }
+
+    /*
+     * Consumer side.
+     */
+    bool clear() override
+    {
+        for(size_t i = 0; i < LEVELS; i++)
+        {
+            levels[i].clear();
+        }
+
+        plan_valid = false;
+        return true;
+    }
+
+    private:
+
+    /*
+     * A run of commands from one class in the consumer's order.
+     */
+    struct plan_segment
+    {
+        size_t level;
+        size_t offset;
+        size_t count;
+    };
+
+    size_t classify(const serial_command &command)
+    {
+        if(classifier == nullptr)
+        {
+            return LEVELS - 1;
+        }
+
+        size_t level = classifier(command, classifier_context);
+        return level < LEVELS ? level : LEVELS - 1;
+    }
+
+    /*
+     * Fixes the consumer's order from the current class sizes: the quota of
+     * every class, then the remainder of every class.
+     */
+    void make_plan()
+    {
+        size_t sizes[LEVELS];
+        plan_size = 0;
+        plan_segments = 0;
+
+        for(size_t i = 0; i < LEVELS; i++)
+        {
+            sizes[i] = levels[i].size();
+            size_t count = sizes[i] < quota[i] ? sizes[i] : quota[i];
+            segments[plan_segments++] = { i, 0, count };
+            plan_size += count;
+        }
+
+        for(size_t i = 0; i < LEVELS; i++)
+        {
+            size_t offset = segments[i].count;
+            segments[plan_segments++] = { i, offset, sizes[i] - offset };
+            plan_size += sizes[i] - offset;
+        }
+
+        plan_valid = true;
+    }
+
+    /*
+     * The commands of each class.
+     */
+    spsc_ringbuffer<serial_command, LEVEL_CAPACITY> levels[LEVELS];
+
+    /*
+     * Producer fields.
+     */
+
+    command_classifier classifier;
+    void *classifier_context;
+
+    /*
+     * The number of commands of each class placed before less urgent
+     * classes.
+     */
+    size_t quota[LEVELS];
+
+    /*
+     * Reserved commands waiting to be classified.
+     */
+    serial_command staging[LEVEL_CAPACITY];
+
+    /*
+     * Consumer fields.
+     */
+
+    /*
+     * If the consumer's order is up to date.
+     */
+    bool plan_valid;
+
+    /*
+     * The number of commands in the consumer's order.
+     */
+    size_t plan_size;
+
+    /*
+     * The consumer's order, as runs of commands from each class.
+     */
+    plan_segment segments[2 * LEVELS];
+
+    size_t plan_segments;
+
+    size_t reserved_;
+};
@@ -0,0 +1,163 @@
+/*
+ * This header contains the class that samples V5 devices in the background.
+ */
+
+#pragma once
+
+#include "vex.h"
+#include "atomic_primitive.h"
+#include "seqlock.h"
+#include "command_dispatcher.h"
+
+/*
+ * Enum for the kind of device a sensor channel samples.
+ */
+enum sensor_kind
+{
+    SENSOR_MOTOR,
+    SENSOR_ADI,
+    SENSOR_IMU
+};
+
+/*
+ * The latest sample of one sensor channel. The meaning of each value
+ * depends on the kind of device:
+ * SENSOR_MOTOR: position, velocity, current in mA.
+ * SENSOR_ADI: the value of the ADI port.
+ * SENSOR_IMU: heading in degrees.
+ * Unused values are 0.
+ */
+struct sensor_snapshot
+{
+    /*
+     * The number of values in a snapshot.
+     */
+    static constexpr size_t MAX_VALUES = 3;
+
+    /*
+     * The system time the sample was taken, in milliseconds.
+     */
+    uint32_t timestamp;
+
+    /*
+     * The sampled values.
+     */
+    float values[MAX_VALUES];
+};
+
+/*
+ * This class creates and maintains a thread that polls V5 devices at
+ * per-channel rates and publishes the samples into a snapshot table. Each
+ * snapshot is protected by a seqlock, so the serial task and the main
+ * thread read consistent samples without taking a mutex and without
+ * querying the device themselves.
+ */
+class sensor_sampler
+{
+    /*
+     * The largest number of sensor channels.
+     */
+    static constexpr size_t MAX_CHANNELS = 32;
+
+    /*
+     * The smart port index of the Brain's built in ADI ports.
+     */
+    static constexpr uint32_t BRAIN_ADI_INDEX = 22;
+
+    /*
+     * The number of addresses used by each channel. Value i of channel c is
+     * read at source_base + c * ADDRESS_STRIDE + i.
+     */
+    static constexpr uint16_t ADDRESS_STRIDE = 4;
+
+    public:
+
+    sensor_sampler();
+
+    /*
+     * Running in main thread.
+     */
+    int32_t add_motor(int32_t port, uint32_t period_ms);
+    int32_t add_adi(uint32_t adi_port, uint32_t period_ms);
+    int32_t add_imu(int32_t port, uint32_t period_ms);
+    bool add_sources(command_dispatcher &dispatcher, uint16_t base_address);
+    void init(vex::brain &brain);
+    void destroy();
+
+    /*
+     * Running in any thread.
+     */
+    bool read(size_t channel, sensor_snapshot &snapshot);
+
+    /*
+     * Running in sampler thread.
+     */
+    static int task_entry(void *arg);
+    void sampler_routine();
+
+    /*
+     * Running in the serial task.
+     */
+    static bool value_source(serial_command &reply, void *context);
+
+    private:
+
+    int32_t add_channel(sensor_kind kind,
+                        int32_t port,
+                        uint32_t adi_port,
+                        uint32_t period_ms);
+    void sample(size_t channel, uint32_t now);
+
+    /*
+     * A device that is sampled and its latest sample.
+     */
+    struct sensor_channel
+    {
+        sensor_kind kind;
+        V5_DeviceT device;
+        uint32_t adi_port;
+        uint32_t period_ms;
+        uint32_t next_sample;
+        seqlock<sensor_snapshot> snapshot;
+    };
+
+    /*
+     * Main thread fields.
+     */
+
+    /*
+     * The thread that the sampler routine is running on.
+     */
+    vex::task sampler_thread;
+
+    /*
+     * Pointer to global VEX Brain object.
+     */
+    vex::brain *brain_ptr;
+
+    /*
+     * The first address of the read requests answered from the snapshot
+     * table. Set before the serial task starts.
+     */
+    uint16_t source_base;
+
+    /*
+     * The number of sensor channels. Set before the sampler thread starts.
+     */
+    size_t channel_count;
+
+    /*
+     * Synchronized fields.
+     */
+
+    /*
+     * If the sampler routine should terminate next iteration.
+     */
+    atomic_primitive<bool> terminated;
+
+    /*
+     * The sensor channels. Their snapshots are written by the sampler thread
+     * and read by any thread.
+     */
+    sensor_channel channels[MAX_CHANNELS];
+};
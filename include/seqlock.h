@@ -0,0 +1,95 @@
+/*
+ * A sequence lock for publishing values from one writer to many readers.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include "vex.h"
+
+/*
+ * A single-writer sequence lock. The writer never waits and readers never
+ * block the writer: the sequence number is odd while a store is in progress,
+ * and a reader retries if the sequence changed while it copied the value.
+ * T must be trivially copyable since it is copied while it may be written.
+ */
+template <typename T>
+class seqlock
+{
+    static_assert(__is_trivially_copyable(T),
+                  "seqlock value must be trivially copyable");
+
+    public:
+    seqlock() :
+        seq(0)
+    {
+        memset(&val_, 0, sizeof(val_));
+    }
+
+    /*
+     * Publishes a new value. Only one thread may store.
+     *
+     * @param val The value to publish.
+     */
+    void store(const T &val)
+    {
+        uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        memcpy(&val_, &val, sizeof(T));
+
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    /*
+     * Copies out the value if no store overlapped the copy.
+     *
+     * @param val The value read.
+     * @return True if a consistent value was read.
+     */
+    bool try_load(T &val)
+    {
+        uint32_t before = seq.load(std::memory_order_acquire);
+        if(before & 1)
+        {
+            return false;
+        }
+
+        memcpy(&val, &val_, sizeof(T));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq.load(std::memory_order_relaxed) == before;
+    }
+
+    /*
+     * Returns a consistent copy of the value. If a store is in progress the
+     * reader yields so the writer can finish.
+     *
+     * @return The value.
+     */
+    T load()
+    {
+        T val;
+        while(!try_load(val))
+        {
+            vex::this_thread::yield();
+        }
+
+        return val;
+    }
+
+    private:
+
+    /*
+     * The number of stores started, times two. Odd while a store is in
+     * progress.
+     */
+    std::atomic<uint32_t> seq;
+
+    /*
+     * The published value.
+     */
+    T val_;
+};
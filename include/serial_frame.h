@@ -10,6 +10,10 @@
 #include <cstdint>
 #include "abstract_queue.h"
 #include "crc16.h"
+#include "cobs.h"
+#include "command_dispatcher.h"
+#include "telemetry_delta.h"
+#include "latency_histogram.h"
 
 /*
  * This is the struct representing a single serial command.
@@ -42,14 +46,21 @@ struct serial_command
      */
     uint8_t data[MAX_COMMAND_LEN];
 
+    /*
+     * The high resolution time the command was queued for transmission, in
+     * microseconds, or 0 if unknown. It is not part of the network format.
+     */
+    uint32_t timestamp;
+
     /*
      * Member functions.
      */
     serial_command();
     ~serial_command();
     serial_command(const serial_command &old);
-    uint8_t checksum();
-    bool is_read();
+    serial_command &operator=(const serial_command &old);
+    uint8_t checksum() const;
+    bool is_read() const;
 };
 
 /*
@@ -57,11 +68,211 @@ struct serial_command
  */
 namespace serial_frame_handler
 {
+    /*
+     * The largest number of queues one frame can be built from.
+     */
+    constexpr size_t MAX_FRAME_QUEUES = 4;
+
+    /*
+     * The high nibble of the first byte of a v2 frame. A v1 frame starts
+     * with the high byte of its command count, which is never this large.
+     */
+    constexpr uint8_t V2_MARKER = 0xA0;
+    constexpr uint8_t V2_MARKER_MASK = 0xF0;
+
+    /*
+     * Flag in the first byte of a v2 frame set if every command carries a
+     * checksum.
+     */
+    constexpr uint8_t V2_FLAG_CHECKSUM = 0x01;
+
+    /*
+     * Flag in the first byte of a v2 frame set if the frame may contain
+     * delta encoded payloads. The frame id and the base id of the
+     * telemetry_delta state follow the first byte.
+     */
+    constexpr uint8_t V2_FLAG_DELTA = 0x02;
+
+    /*
+     * The payload size nibble of a v2 command whose payload is delta
+     * encoded against the reference of its address. The payload has the
+     * size of the reference.
+     */
+    constexpr uint8_t V2_DELTA_SIZE = 0x0F;
+
+    /*
+     * The longest v2 command: header, 3 byte address delta, payload and
+     * checksum.
+     */
+    constexpr size_t V2_MAX_COMMAND_LEN = 4 + serial_command::MAX_COMMAND_LEN + 1;
+
+    /*
+     * Addresses 0x7F00 to 0x7FFF, with or without the read flag, are
+     * reserved for link control commands between master and slave.
+     */
+    constexpr uint16_t LINK_ADDRESS_BASE = 0x7F00;
+
+    /*
+     * Link control address of the capability handshake. The master writes
+     * the highest wire format version it accepts and the v2 flags it wants;
+     * the slave answers with the version and flags it will transmit.
+     */
+    constexpr uint16_t LINK_CAPS = LINK_ADDRESS_BASE;
+
+    /*
+     * Link control address the master writes the id of the last frame it
+     * decoded to, so delta encoded payloads of that frame can be used as
+     * references.
+     */
+    constexpr uint16_t LINK_DELTA_ACK = LINK_ADDRESS_BASE + 1;
+
+    /*
+     * Link control address of baud rate changes, with a 4 byte big endian
+     * baud rate as payload. The master writes it to request a rate; the
+     * slave writes it to announce the rate it switches to, either the
+     * requested one or a lower one when too many frames are corrupted. Both
+     * ends switch once the frame announcing the rate has been sent.
+     */
+    constexpr uint16_t LINK_BAUD = LINK_ADDRESS_BASE + 2;
+
+    /*
+     * Addresses 0x7F80 to 0x7FFF of the link control range are read-only
+     * statistics of the slave. Reading one answers with a 4 byte big endian
+     * value; writes are ignored.
+     */
+    constexpr uint16_t LINK_STATS_BASE = LINK_ADDRESS_BASE + 0x80;
+
+    /*
+     * The frame counters, total error counters, last turnaround time in
+     * microseconds and current baud rate of the slave.
+     */
+    constexpr uint16_t LINK_STAT_RX_FRAMES = LINK_STATS_BASE;
+    constexpr uint16_t LINK_STAT_TX_FRAMES = LINK_STATS_BASE + 1;
+    constexpr uint16_t LINK_STAT_RX_ERRORS = LINK_STATS_BASE + 2;
+    constexpr uint16_t LINK_STAT_TX_ERRORS = LINK_STATS_BASE + 3;
+    constexpr uint16_t LINK_STAT_TURNAROUND = LINK_STATS_BASE + 4;
+    constexpr uint16_t LINK_STAT_BAUD = LINK_STATS_BASE + 5;
+
+    /*
+     * The receive error counters, one per rx_error_cause starting here.
+     */
+    constexpr uint16_t LINK_STAT_RX_ERROR_BASE = LINK_STATS_BASE + 0x10;
+
+    /*
+     * The transmit error counters, one per tx_error_cause starting here.
+     */
+    constexpr uint16_t LINK_STAT_TX_ERROR_BASE = LINK_STATS_BASE + 0x20;
+
+    /*
+     * The latency histograms, 4 addresses per latency_stage starting here:
+     * the count, p50, p99 and max, in microseconds.
+     */
+    constexpr uint16_t LINK_STAT_LATENCY_BASE = LINK_STATS_BASE + 0x40;
+
+    /*
+     * Result of parsing the commands of a received frame.
+     */
+    enum parse_status
+    {
+        PARSE_OK,
+
+        /*
+         * The frame does not follow the format.
+         */
+        PARSE_MALFORMED,
+
+        /*
+         * A command has a payload longer than MAX_COMMAND_LEN.
+         */
+        PARSE_OVERSIZE,
+
+        /*
+         * The checksum of a command does not match.
+         */
+        PARSE_CHECKSUM,
+
+        /*
+         * The receive queue has no room for the commands of the frame.
+         */
+        PARSE_QUEUE_FULL
+    };
+
+    /*
+     * A wire format for transmitted frames.
+     */
+    struct frame_format
+    {
+        /*
+         * The format version, 1 or 2.
+         */
+        uint8_t version;
+
+        /*
+         * If v2 commands carry a checksum. v1 commands always do.
+         */
+        bool checksums;
+
+        /*
+         * If v2 payloads may be delta encoded.
+         */
+        bool deltas;
+    };
+
+    /*
+     * The original format, understood by every master.
+     */
+    constexpr frame_format FORMAT_V1 = { 1, true, false };
+
+    /*
+     * Returns true if a decoded frame uses the v2 format.
+     */
+    inline bool is_v2(const uint8_t *buf)
+    {
+        return (buf[0] & V2_MARKER_MASK) == V2_MARKER;
+    }
+
+    /*
+     * Returns true if an address is in the link control range.
+     */
+    inline bool is_link_address(uint16_t address)
+    {
+        return (address & 0x7F00) == LINK_ADDRESS_BASE;
+    }
+
     bool buf2queue(uint8_t *buf, 
                    size_t len,
-                   abstract_queue<serial_command> &queue);
+                   abstract_queue<serial_command> &queue,
+                   command_dispatcher *dispatcher = nullptr,
+                   abstract_queue<serial_command> *replies = nullptr);
+
+    parse_status commands2queue(uint8_t *buf,
+                                size_t len,
+                                abstract_queue<serial_command> &queue,
+                                command_dispatcher *dispatcher = nullptr,
+                                abstract_queue<serial_command> *replies = nullptr,
+                                command_handler link_handler = nullptr,
+                                void *link_context = nullptr);
 
     size_t queue2buf(abstract_queue<serial_command> &queue,
                      uint8_t *buf, size_t max_len);
 
+    size_t queue2cobs(abstract_queue<serial_command> &queue,
+                      uint8_t *encoded_buf, size_t max_len);
+
+    size_t queue2cobs(abstract_queue<serial_command> &queue,
+                      uint8_t *encoded_buf, size_t max_len,
+                      const uint8_t *header, size_t header_len);
+
+    size_t queue2cobs(abstract_queue<serial_command> *const *queues,
+                      size_t queue_count,
+                      uint8_t *encoded_buf, size_t max_len,
+                      const uint8_t *header, size_t header_len,
+                      const frame_format &format = FORMAT_V1,
+                      telemetry_delta *delta = nullptr,
+                      latency_histogram *queue_wait = nullptr,
+                      uint32_t now_us = 0,
+                      uint16_t *framed = nullptr);
+
+    uint16_t command_count(const uint8_t *buf, size_t len);
+
 }
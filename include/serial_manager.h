@@ -0,0 +1,109 @@
+/*
+ * This header contains the class that services several serial ports from a
+ * single thread.
+ */
+
+#pragma once
+
+#include "vex.h"
+#include "atomic_primitive.h"
+#include "serial_port.h"
+
+/*
+ * Enum for the order in which the serial manager polls its ports.
+ * ROUND_ROBIN polls every port that is due once per pass, starting one port
+ * later each pass so no port is always served first. EARLIEST_DEADLINE
+ * always polls the port that has been due the longest.
+ */
+enum serial_schedule
+{
+    ROUND_ROBIN,
+    EARLIEST_DEADLINE
+};
+
+/*
+ * This class creates and maintains one thread that handles serial I/O for
+ * every registered smart port. Each port keeps its own buffers, so they can
+ * be sized per link.
+ */
+class serial_manager
+{
+    /*
+     * The number of smart ports on the V5 Brain.
+     */
+    static constexpr size_t MAX_PORTS = 21;
+
+    public:
+
+    serial_manager();
+
+    /*
+     * Running in main thread.
+     */
+    bool add(serial_port &ser_port, int32_t port, int32_t baudrate);
+    void init(vex::brain &brain, serial_schedule schedule);
+    void destroy();
+
+    /*
+     * Running in ser_thread.
+     */
+    static int task_entry(void *arg);
+    void manager_routine();
+
+    private:
+
+    void poll_round_robin(uint32_t now);
+    void poll_earliest_deadline(uint32_t now);
+
+    /*
+     * Main thread fields.
+     */
+
+    /*
+     * The thread that the manager routine is running on.
+     */
+    vex::task ser_thread;
+
+    /*
+     * Pointer to global VEX Brain object.
+     */
+    vex::brain *brain_ptr;
+
+    /*
+     * The registered serial ports.
+     */
+    serial_port *ports[MAX_PORTS];
+
+    /*
+     * The number of registered serial ports.
+     */
+    size_t port_count;
+
+    /*
+     * The order the ports are polled in.
+     */
+    serial_schedule schedule_;
+
+    /*
+     * Synchronized fields.
+     */
+
+    /*
+     * If the manager routine should terminate next iteration.
+     */
+    atomic_primitive<bool> terminated;
+
+    /*
+     * Manager thread fields.
+     */
+
+    /*
+     * The system time each port next expects work, in milliseconds.
+     */
+    uint32_t wake_times[MAX_PORTS];
+
+    /*
+     * The port the next round robin pass starts at.
+     */
+    size_t next_port;
+};
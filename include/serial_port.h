@@ -0,0 +1,658 @@
+/*
+ * This header contains the classes that handle serial I/O for a single
+ * smart port.
+ *
+ * @author John Sauer
+ * @date 10/14/2019
+ */
+
+#pragma once
+
+#include "vex.h"
+#include "atomic_primitive.h"
+#include "abstract_queue.h"
+#include "spsc_ringbuffer.h"
+#include "cobs.h"
+#include "serial_frame.h"
+#include "command_dispatcher.h"
+#include "latency_histogram.h"
+
+
+/*
+ * Enum for serial I/O state machine.
+ */
+enum serial_state
+{
+    TRANSMITTING,
+    START_RECEIVE,
+    RECEIVING
+};
+
+/*
+ * Enum for the duplex mode of a serial link. In half-duplex mode every
+ * received frame is answered with exactly one transmitted frame. In
+ * full-duplex mode both directions run independently with sequence numbered
+ * frames and a window of unacknowledged frames in flight.
+ */
+enum serial_mode
+{
+    HALF_DUPLEX,
+    FULL_DUPLEX
+};
+
+/*
+ * Enum for the causes of receive errors.
+ */
+enum rx_error_cause
+{
+    /*
+     * A frame did not end within the receive timeout.
+     */
+    RX_TIMEOUT,
+
+    /*
+     * A frame did not fit in the receive frame buffer.
+     */
+    RX_OVERFLOW,
+
+    /*
+     * A frame was not valid COBS.
+     */
+    RX_DECODE,
+
+    /*
+     * The CRC16 of a frame did not match.
+     */
+    RX_CRC,
+
+    /*
+     * The checksum of a command did not match.
+     */
+    RX_CHECKSUM,
+
+    /*
+     * A command had a payload longer than MAX_COMMAND_LEN.
+     */
+    RX_OVERSIZE,
+
+    /*
+     * The receive queue had no room for the commands of a frame.
+     */
+    RX_QUEUE_FULL,
+
+    /*
+     * A frame was empty, too short or did not follow the format.
+     */
+    RX_MALFORMED,
+
+    /*
+     * Full-duplex frames went missing between two received frames.
+     */
+    RX_SEQUENCE,
+
+    RX_ERROR_CAUSES
+};
+
+/*
+ * Enum for the causes of transmit errors.
+ */
+enum tx_error_cause
+{
+    /*
+     * A frame could not be built from the queued commands.
+     */
+    TX_FRAME,
+
+    /*
+     * The smart port accepted fewer bytes than the frame holds.
+     */
+    TX_SHORT_WRITE,
+
+    /*
+     * A full-duplex frame was not acknowledged in time.
+     */
+    TX_ACK_TIMEOUT,
+
+    TX_ERROR_CAUSES
+};
+
+/*
+ * Enum for the stages of the serial pipeline whose latency is measured.
+ */
+enum latency_stage
+{
+    /*
+     * From the first byte of a received frame to its delimiter.
+     */
+    LATENCY_RX_FRAME,
+
+    /*
+     * Time spent COBS decoding, checking and parsing a received frame.
+     */
+    LATENCY_RX_DECODE,
+
+    /*
+     * Time a command queued with send() waited for its frame.
+     */
+    LATENCY_QUEUE_WAIT,
+
+    /*
+     * From the end of a received frame to its reply being transmitted, in
+     * half-duplex mode.
+     */
+    LATENCY_TURNAROUND,
+
+    LATENCY_STAGES
+};
+
+/*
+ * This class handles serial I/O for a single smart port. It owns no frame
+ * buffers or command queues; those are supplied by a derived class such as
+ * sized_serial_port so every port can be sized for its traffic. The serial
+ * routine is driven one step at a time through poll(), either by a
+ * serial_thread dedicated to the port or by a serial_manager servicing
+ * several ports from one task.
+ */
+class serial_port
+{
+    /*
+     * The capacity of the buffer raw received bytes are read into.
+     */
+    static constexpr size_t RX_CHUNK_CAP = 512;
+
+    /*
+     * The capacity of the queue of replies to read requests answered by
+     * value sources.
+     */
+    static constexpr size_t REPLY_QUEUE_SIZE = 64;
+
+    /*
+     * The receive timeout period, in milliseconds.
+     */
+    static constexpr uint32_t TIMEOUT = 50;
+
+    /*
+     * The time a full-duplex frame may stay unacknowledged, in milliseconds.
+     */
+    static constexpr uint32_t ACK_TIMEOUT = 100;
+
+    /*
+     * The largest full-duplex in-flight window. Sequence numbers are 8 bits,
+     * so the window must stay below half of their range.
+     */
+    static constexpr uint8_t MAX_WINDOW = 127;
+
+    /*
+     * The length of the sequence and acknowledgement header that starts
+     * every full-duplex frame.
+     */
+    static constexpr size_t FULL_DUPLEX_HEADER_LEN = 2;
+
+    /*
+     * The shortest sleep of the serial routine, in milliseconds.
+     */
+    static constexpr uint32_t ITER_TIME = 1;
+
+    /*
+     * The longest sleep of the serial routine while the link is idle, in
+     * milliseconds.
+     */
+    static constexpr uint32_t MAX_IDLE_TIME = 8;
+
+    /*
+     * The time a new baud rate has to carry a valid frame before the port
+     * returns to the last rate that did, in milliseconds.
+     */
+    static constexpr uint32_t BAUD_TRIAL_TIME = 500;
+
+    /*
+     * The time without a valid frame after which the port returns to its
+     * configured baud rate, in milliseconds.
+     */
+    static constexpr uint32_t LINK_LOSS_TIME = 1000;
+
+    /*
+     * The number of received frames, valid or not, the error rate is
+     * measured over.
+     */
+    static constexpr uint32_t QUALITY_WINDOW = 32;
+
+    /*
+     * The baud rate steps down when more than 1 in MAX_ERROR_RATIO received
+     * frames of a window are errors.
+     */
+    static constexpr uint32_t MAX_ERROR_RATIO = 8;
+
+    public:
+
+    serial_port(uint8_t *rx_buf,
+                size_t rx_buf_cap,
+                uint8_t *tx_buf,
+                size_t tx_buf_cap,
+                abstract_queue<serial_command> &rx_queue,
+                abstract_queue<serial_command> &tx_queue);
+
+    /*
+     * Running in main thread.
+     */
+    void set_mode(serial_mode mode, uint8_t window);
+    void configure(int32_t port, int32_t baudrate);
+    void set_dispatcher(command_dispatcher *dispatcher);
+    void set_max_baudrate(int32_t baudrate);
+    size_t rx_frames();
+    size_t rx_errors();
+    size_t rx_errors(rx_error_cause cause);
+    size_t tx_frames();
+    size_t tx_errors();
+    size_t tx_errors(tx_error_cause cause);
+    size_t turnaround_us();
+    int32_t baudrate();
+    latency_histogram &latency(latency_stage stage);
+    bool send(const serial_command &command);
+    abstract_queue<serial_command> &rx_queue();
+    abstract_queue<serial_command> &tx_queue();
+
+    /*
+     * Running in the serial task.
+     */
+    void start(vex::brain &brain);
+    uint32_t poll();
+
+    private:
+
+    uint32_t time_us();
+    bool fill_rx_chunk();
+    uint32_t next_wake_time(uint32_t now);
+    void transmit_frame();
+    bool can_transmit(uint32_t now);
+    void receive_ack(uint8_t ack);
+    void receive_sequence(uint8_t seq, uint16_t command_num);
+    void expire_in_flight(uint32_t now);
+    static bool link_command(serial_command &command, void *context);
+    bool link_stat(uint16_t address, uint32_t &value);
+    void count_rx_error(rx_error_cause cause);
+    void count_tx_error(tx_error_cause cause);
+    void request_baud(int32_t baudrate);
+    void set_baud(int32_t baudrate, uint32_t now);
+    uint32_t line_errors();
+    void check_link_quality();
+    void check_link_loss(uint32_t now);
+
+    /*
+     * Synchronized fields.
+     */
+
+    /*
+     * Number of complete frames received.
+     */
+    atomic_primitive<uint32_t> rx_frames_;
+
+    /*
+     * Number of complete frames transmitted.
+     */
+    atomic_primitive<uint32_t> tx_frames_;
+
+    /*
+     * Number of receive errors.
+     */
+    atomic_primitive<uint32_t> rx_errors_;
+
+    /*
+     * Number of transmit errors.
+     */
+    atomic_primitive<uint32_t> tx_errors_;
+
+    /*
+     * Number of receive errors of each cause.
+     */
+    atomic_primitive<uint32_t> rx_error_counts_[RX_ERROR_CAUSES];
+
+    /*
+     * Number of transmit errors of each cause.
+     */
+    atomic_primitive<uint32_t> tx_error_counts_[TX_ERROR_CAUSES];
+
+    /*
+     * Time from the end of the last received frame to its reply being
+     * transmitted, in microseconds.
+     */
+    atomic_primitive<uint32_t> turnaround_us_;
+
+    /*
+     * The baud rate the smart port currently runs at.
+     */
+    atomic_primitive<int32_t> baud_;
+
+    /*
+     * Latencies of the pipeline stages, in microseconds. Recorded by the
+     * serial task and readable from any thread.
+     */
+    latency_histogram latency_[LATENCY_STAGES];
+
+    /*
+     * Queue for received serial commands. The serial task is the only
+     * producer and the main thread is the only consumer.
+     */
+    abstract_queue<serial_command> &rx_queue_;
+
+    /*
+     * Queue for transmitted serial commands. The main thread is the only
+     * producer and the serial task is the only consumer.
+     */
+    abstract_queue<serial_command> &tx_queue_;
+
+    /*
+     * Handlers for received commands, or null to queue every command. Set
+     * before the serial task starts.
+     */
+    command_dispatcher *dispatcher_;
+
+    /*
+     * Pointer to global VEX Brain object.
+     */
+    vex::brain *brain_ptr;
+
+    /*
+     * The duplex mode of the link. Set before the serial task starts.
+     */
+    serial_mode mode_;
+
+    /*
+     * The number of unacknowledged full-duplex frames allowed in flight.
+     * Set before the serial task starts.
+     */
+    uint8_t window_;
+
+    /*
+     * The smart port number. Set before the serial task starts.
+     */
+    int32_t port_;
+
+    /*
+     * The baudrate of the smart port. The link starts at this rate and
+     * returns to it when it is lost. Set before the serial task starts.
+     */
+    int32_t baudrate_;
+
+    /*
+     * The highest baud rate the master may switch the link to. Set before
+     * the serial task starts.
+     */
+    int32_t max_baudrate_;
+
+    /*
+     * Serial task fields.
+     */
+
+    /*
+     * Replies to read requests answered by value sources while parsing. They
+     * are sent ahead of the transmit queue in the next frame.
+     */
+    spsc_ringbuffer<serial_command, REPLY_QUEUE_SIZE> reply_queue_;
+
+    /*
+     * The wire format of transmitted frames. Starts as v1 and changes when
+     * the master completes the capability handshake.
+     */
+    serial_frame_handler::frame_format tx_format_;
+
+    /*
+     * References for delta encoding transmitted payloads.
+     */
+    telemetry_delta delta_;
+
+    /*
+     * The smart port used for serial communication/
+     */
+    V5_DeviceT smart_port;
+
+    /*
+     * The state of the serial I/O state machine
+     */
+    serial_state ser_state;
+
+    /*
+     * Buffer containing raw bytes read from the smart port.
+     */
+    uint8_t rx_chunk[RX_CHUNK_CAP];
+
+    /*
+     * The index of the next unread byte in rx_chunk.
+     */
+    size_t rx_chunk_pos;
+
+    /*
+     * The number of bytes in rx_chunk.
+     */
+    size_t rx_chunk_len;
+
+    /*
+     * Buffer containing the decoded frame being received.
+     */
+    uint8_t *rx_buf;
+
+    /*
+     * The capacity of the receive frame buffer.
+     */
+    size_t rx_buf_cap;
+
+    /*
+     * Buffer containing COBS encoded frames transmitted.
+     */
+    uint8_t *tx_buf;
+
+    /*
+     * The capacity of the transmit frame buffer.
+     */
+    size_t tx_buf_cap;
+
+    /*
+     * Streaming decoder for the frame being received.
+     */
+    cobs::decoder rx_decoder;
+
+    /*
+     * Running CRC of the frame being received.
+     */
+    crc::crc16_state rx_crc;
+
+    /*
+     * The number of decoded bytes already added to rx_crc.
+     */
+    size_t rx_crc_len;
+
+    /*
+     * The timestamp when the frame reception times out.
+     */
+    uint32_t rx_timeout;
+
+    /*
+     * The number of bytes the smart port moves per millisecond at the
+     * configured baud rate, assuming 10 bits per byte.
+     */
+    uint32_t bytes_per_ms;
+
+    /*
+     * The current sleep time while the link is idle, in milliseconds.
+     */
+    uint32_t idle_time;
+
+    /*
+     * The timestamp when the last transmitted frame has left the wire.
+     */
+    uint32_t tx_clear_time;
+
+    /*
+     * The decoded frame length when the wake time was last computed.
+     */
+    size_t rx_progress;
+
+    /*
+     * The high resolution timestamp when the last frame was received, in
+     * microseconds.
+     */
+    uint32_t rx_complete_us;
+
+    /*
+     * The high resolution timestamp when the first byte of the frame being
+     * received was seen, in microseconds.
+     */
+    uint32_t rx_start_us;
+
+    /*
+     * The time spent decoding the frame being received so far, in
+     * microseconds.
+     */
+    uint32_t rx_decode_us;
+
+    /*
+     * The sequence number of the next full-duplex frame transmitted.
+     */
+    uint8_t tx_seq;
+
+    /*
+     * The sequence number of the oldest unacknowledged transmitted frame.
+     * Frames from tx_acked up to tx_seq are in flight.
+     */
+    uint8_t tx_acked;
+
+    /*
+     * The sequence number of the next full-duplex frame expected from the
+     * peer. It is sent back as the acknowledgement.
+     */
+    uint8_t rx_expected;
+
+    /*
+     * The number of frames counted as receive errors since the last
+     * sequenced frame. A sequence gap this wide is already counted.
+     */
+    uint8_t rx_lost;
+
+    /*
+     * If a received frame has not been acknowledged yet.
+     */
+    bool ack_owed;
+
+    /*
+     * The timestamp when the oldest in-flight frame expires.
+     */
+    uint32_t ack_deadline;
+
+    /*
+     * The baud rate the smart port runs at.
+     */
+    int32_t current_baud;
+
+    /*
+     * The last baud rate that carried a valid frame.
+     */
+    int32_t confirmed_baud;
+
+    /*
+     * The baud rate to switch to once the frame announcing it has been
+     * transmitted, or 0.
+     */
+    int32_t pending_baud;
+
+    /*
+     * If the frame announcing pending_baud has been transmitted and the
+     * switch waits for it to leave the wire.
+     */
+    bool baud_switch_armed;
+
+    /*
+     * The timestamp when the pending baud rate switch happens.
+     */
+    uint32_t baud_switch_time;
+
+    /*
+     * The timestamp when an unconfirmed baud rate is given up.
+     */
+    uint32_t baud_trial_deadline;
+
+    /*
+     * The timestamp of the last valid received frame.
+     */
+    uint32_t last_rx_time;
+
+    /*
+     * The received frame and line noise error counts when the current
+     * error rate window started.
+     */
+    uint32_t window_frames;
+    uint32_t window_errors;
+};
+
+/*
+ * A serial_port with its own frame buffers and lock-free command queues.
+ *
+ * @tparam RX_BUF_CAP The capacity of the receive frame buffer.
+ * @tparam TX_BUF_CAP The capacity of the transmit frame buffer.
+ * @tparam QUEUE_SIZE The capacity of the default transmit and receive serial
+ * command queues. Must be a power of two.
+ * @tparam RX_QUEUE The type of the receive queue, for example a
+ * coalescing_queue so stale setpoints do not pile up.
+ * @tparam TX_QUEUE The type of the transmit queue.
+ */
+template <size_t RX_BUF_CAP,
+          size_t TX_BUF_CAP,
+          size_t QUEUE_SIZE,
+          typename RX_QUEUE = spsc_ringbuffer<serial_command, QUEUE_SIZE>,
+          typename TX_QUEUE = spsc_ringbuffer<serial_command, QUEUE_SIZE> >
+class sized_serial_port : public serial_port
+{
+    public:
+
+    /*
+     * The storage members are only handed to serial_port here, not used,
+     * so it does not matter that they are constructed after the base.
+     */
+    sized_serial_port() :
+        serial_port(rx_buf_storage, RX_BUF_CAP,
+                    tx_buf_storage, TX_BUF_CAP,
+                    rx_queue_storage, tx_queue_storage)
+    {
+    }
+
+    /*
+     * Returns the serial command receive queue.
+     *
+     * @return The serial command receive queue.
+     */
+    RX_QUEUE &rx_queue()
+    {
+        return rx_queue_storage;
+    }
+
+    /*
+     * Returns the serial command transmit queue.
+     *
+     * @return The serial command transmit queue.
+     */
+    TX_QUEUE &tx_queue()
+    {
+        return tx_queue_storage;
+    }
+
+    private:
+
+    /*
+     * Buffer containing the decoded frame being received.
+     */
+    uint8_t rx_buf_storage[RX_BUF_CAP];
+
+    /*
+     * Buffer containing COBS encoded frames transmitted.
+     */
+    uint8_t tx_buf_storage[TX_BUF_CAP];
+
+    /*
+     * Queue for received serial commands.
+     */
+    RX_QUEUE rx_queue_storage;
+
+    /*
+     * Queue for transmitted serial commands.
+     */
+    TX_QUEUE tx_queue_storage;
+};
\ No newline at end of file
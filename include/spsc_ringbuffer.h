@@ -0,0 +1,184 @@
+/*
+ * A lock-free single-producer/single-consumer ring buffer.
+ */
+
+#pragma once
+
+#include <atomic>
+#include "abstract_queue.h"
+
+/*
+ * A lock-free ring buffer that is safe for exactly one producing thread and
+ * exactly one consuming thread. The head index is only written by the
+ * consumer and the tail index is only written by the producer, so no mutex
+ * is needed. CAPACITY must be a power of two so indices can be masked
+ * instead of taken modulo.
+ *
+ * The indices run freely and wrap at the size_t boundary. The number of
+ * elements in the buffer is always tail - head.
+ */
+template <typename T, size_t CAPACITY>
+class spsc_ringbuffer : public abstract_queue<T>
+{
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0,
+                  "spsc_ringbuffer CAPACITY must be a power of two");
+
+    /*
+     * Mask applied to a free running index to get a buffer position.
+     */
+    static constexpr size_t MASK = CAPACITY - 1;
+
+    public:
+    spsc_ringbuffer<T, CAPACITY>() :
+        head_ptr(0),
+        tail_ptr(0),
+        reserved_(0)
+    {
+    }
+
+    ~spsc_ringbuffer<T, CAPACITY>()
+    {
+    }
+
+    size_t size() override
+    {
+        size_t tail = tail_ptr.load(std::memory_order_acquire);
+        size_t head = head_ptr.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    bool empty() override
+    {
+        return size() == 0;
+    }
+
+    bool full() override
+    {
+        return size() == CAPACITY;
+    }
+
+    size_t capacity() override
+    {
+        return CAPACITY;
+    }
+
+    /*
+     * Producer side. Only the producing thread may call this.
+     */
+    bool push(const T &element) override
+    {
+        size_t tail = tail_ptr.load(std::memory_order_relaxed);
+
+        if(tail - head_ptr.load(std::memory_order_acquire) == CAPACITY)
+        {
+            return false;
+        }
+
+        buffer[tail & MASK] = element;
+        tail_ptr.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Consumer side. Only the consuming thread may call this.
+     */
+    bool pop(T &element) override
+    {
+        size_t head = head_ptr.load(std::memory_order_relaxed);
+
+        if(tail_ptr.load(std::memory_order_acquire) == head)
+        {
+            return false;
+        }
+
+        element = buffer[head & MASK];
+        head_ptr.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Consumer side. Elements stay in place until consume releases them.
+     */
+    T &peek(size_t i) override
+    {
+        return buffer[(head_ptr.load(std::memory_order_relaxed) + i) & MASK];
+    }
+
+    bool consume(size_t n) override
+    {
+        size_t head = head_ptr.load(std::memory_order_relaxed);
+
+        if(tail_ptr.load(std::memory_order_acquire) - head < n)
+        {
+            return false;
+        }
+
+        head_ptr.store(head + n, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Producer side. Reserved slots are invisible to the consumer until
+     * commit publishes them with a single release store of the tail index.
+     */
+    bool reserve(size_t n) override
+    {
+        size_t tail = tail_ptr.load(std::memory_order_relaxed);
+
+        if(CAPACITY - (tail - head_ptr.load(std::memory_order_acquire)) < n)
+        {
+            return false;
+        }
+
+        reserved_ = n;
+        return true;
+    }
+
+    T &reserved(size_t i) override
+    {
+        return buffer[(tail_ptr.load(std::memory_order_relaxed) + i) & MASK];
+    }
+
+    bool commit(size_t n) override
+    {
+        bool valid = n <= reserved_;
+
+        if(valid)
+        {
+            tail_ptr.store(tail_ptr.load(std::memory_order_relaxed) + n,
+                           std::memory_order_release);
+        }
+
+        reserved_ = 0;
+        return valid;
+    }
+
+    /*
+     * Consumer side. Discards every element currently visible to the
+     * consumer. Elements pushed concurrently may survive the clear.
+     */
+    bool clear() override
+    {
+        head_ptr.store(tail_ptr.load(std::memory_order_acquire),
+                       std::memory_order_release);
+        return true;
+    }
+
+    private:
+    T buffer[CAPACITY];
+
+    /*
+     * Free running index of the next element to pop. Written by the consumer.
+     */
+    std::atomic<size_t> head_ptr;
+
+    /*
+     * Free running index of the next free slot. Written by the producer.
+     */
+    std::atomic<size_t> tail_ptr;
+
+    /*
+     * Number of slots in the producer's current reservation.
+     */
+    size_t reserved_;
+};
@@ -0,0 +1,97 @@
+/*
+ * Contains the state for delta encoding transmitted telemetry.
+ */
+
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+
+struct serial_command;
+
+/*
+ * Keeps, for each recently transmitted address, the payload the master is
+ * known to hold, so that new payloads can be sent as small differences.
+ *
+ * A payload is split into 4 byte big endian words, the last one possibly
+ * shorter, and each word is sent as the zig-zag varint of its difference to
+ * the reference word. Slowly changing counters, timestamps and floats then
+ * take 1 or 2 bytes instead of 4.
+ *
+ * Every frame carrying deltas has an 8 bit id and names the id of the frame
+ * its references come from, its base. Payloads sent in a frame only become
+ * references once the master acknowledges that frame, so a lost frame or a
+ * lost acknowledgement never leaves the two ends with different references:
+ * the next frame is simply encoded against the older base again. The
+ * master keeps the references as of the base plus the payloads of the last
+ * frame it decoded, and promotes those once a frame names that frame as its
+ * base. A base of NO_BASE means every reference was dropped.
+ */
+class telemetry_delta
+{
+    /*
+     * The number of addresses that can have a reference.
+     */
+    static constexpr size_t MAX_ENTRIES = 64;
+
+    /*
+     * The number of table entries probed for an address.
+     */
+    static constexpr size_t PROBE_LIMIT = 8;
+
+    public:
+
+    /*
+     * The base of a frame encoded without references.
+     */
+    static constexpr uint8_t NO_BASE = 0xFF;
+
+    /*
+     * The largest encoding of a delta payload: 2 varints of at most 5 bytes.
+     */
+    static constexpr size_t MAX_DELTA_LEN = 10;
+
+    telemetry_delta();
+
+    void reset();
+    void begin_frame();
+    uint8_t frame_id();
+    uint8_t base_id();
+    size_t encode(const serial_command &command, uint8_t *out);
+    void record(const serial_command &command);
+    void ack(uint8_t id);
+
+    private:
+
+    /*
+     * The reference and pending payload of one address.
+     */
+    struct delta_entry
+    {
+        uint16_t address;
+        bool used;
+        bool ref_valid;
+        uint8_t ref_size;
+        uint8_t ref[8];
+        bool pending_valid;
+        uint8_t pending_size;
+        uint8_t pending[8];
+    };
+
+    delta_entry *find(uint16_t address, bool insert);
+
+    /*
+     * The table of addresses.
+     */
+    delta_entry entries[MAX_ENTRIES];
+
+    /*
+     * The id of the frame being built or last sent.
+     */
+    uint8_t frame_id_;
+
+    /*
+     * The id of the frame the references come from.
+     */
+    uint8_t base_id_;
+};
@@ -1,14 +1,128 @@
 /*
 * COBS encoding and decoding functions.
-* The encode function was shamelessly lifted from
+* The encode function was originally lifted from
 * https://github.com/bakercp/PacketSerial/blob/master/src/Encoding/COBS.h
+* and now copies whole runs of nonzero bytes at once.
 *
 * @date 10/13/2019
 * @author John Sauer, bakercp
 */
 
+#include <cstring>
 #include "cobs.h"
 
+/*
+ * Select the widest zero byte search kernel available at compile time.
+ * NEON is used on the V5's Cortex-A9, SSE2/AVX2 on x86 host builds and a
+ * word-at-a-time (SWAR) search everywhere else.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+/*
+ * Finds the first zero byte in a buffer.
+ *
+ * @param buffer The buffer being searched.
+ * @param size The number of bytes to search.
+ *
+ * @return The index of the first zero byte, or size if there is none.
+ */
+static size_t find_zero(const uint8_t* buffer, size_t size)
+{
+    size_t index = 0;
+
+#if defined(__AVX2__)
+    /*
+     * Compare 32 bytes at a time against zero and locate the first match
+     * from the comparison bit mask.
+     */
+    const __m256i zero = _mm256_setzero_si256();
+    for(; index + 32 <= size; index += 32)
+    {
+        __m256i block = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(buffer + index));
+        uint32_t mask = static_cast<uint32_t>(
+          _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero)));
+
+        if(mask != 0)
+        {
+            return index + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    /*
+     * Compare 16 bytes at a time against zero and locate the first match
+     * from the comparison bit mask.
+     */
+    const __m128i zero = _mm_setzero_si128();
+    for(; index + 16 <= size; index += 16)
+    {
+        __m128i block = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(buffer + index));
+        uint32_t mask = static_cast<uint32_t>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(block, zero)));
+
+        if(mask != 0)
+        {
+            return index + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    /*
+     * Compare 16 bytes at a time against zero. ARMv7 has no horizontal
+     * reduction, so fold the comparison down to 64 bits and leave the exact
+     * position of a match to the byte loop below.
+     */
+    for(; index + 16 <= size; index += 16)
+    {
+        uint8x16_t matches = vceqq_u8(vld1q_u8(buffer + index),
+                                      vdupq_n_u8(0));
+        uint8x8_t folded = vorr_u8(vget_low_u8(matches),
+                                   vget_high_u8(matches));
+
+        if(vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0)
+        {
+            break;
+        }
+    }
+#else
+    /*
+     * Test a machine word at a time with the classic "has zero byte" bit
+     * trick and leave the exact position of a match to the byte loop below.
+     */
+    const size_t ones = static_cast<size_t>(-1) / 0xFF;
+    const size_t highs = ones << 7;
+    for(; index + sizeof(size_t) <= size; index += sizeof(size_t))
+    {
+        size_t word;
+        memcpy(&word, buffer + index, sizeof(word));
+
+        if(((word - ones) & ~word & highs) != 0)
+        {
+            break;
+        }
+    }
+#endif
+
+    /*
+     * Finish the search one byte at a time.
+     */
+    for(; index < size; index++)
+    {
+        if(buffer[index] == 0)
+        {
+            return index;
+        }
+    }
+
+    return size;
+}
+
 /*
  * Encodes a message using COBS encoding.
  * 
@@ -23,53 +137,58 @@ size_t cobs::encode(const uint8_t* buffer,
               uint8_t* encoded_buffer)
 {
     /*
-     * Set initial indices and values.
+     * Set initial indices.
      */
     size_t read_index = 0;
     size_t write_index = 1;
     size_t code_index = 0;
-    uint8_t code = 1;
 
-    /*
-     * Loop until entire source buffer is consumed.
-     */
-    while (read_index < size)
+    while (true)
     {
         /*
-         * Update code index if the current value in the buffer equals 0.
+         * Find the run of nonzero bytes starting at the read index. A block
+         * holds at most 254 data bytes.
+         */
+        size_t remaining = size - read_index;
+        size_t run = find_zero(buffer + read_index,
+                               remaining < 0xFE ? remaining : 0xFE);
+
+        /*
+         * Copy the whole run into the encoded buffer.
          */
-        if (buffer[read_index] == 0)
+        memcpy(encoded_buffer + write_index, buffer + read_index, run);
+        write_index += run;
+        read_index += run;
+
+        /*
+         * A full block always starts a new block without consuming a zero.
+         */
+        if (run == 0xFE)
         {
-            encoded_buffer[code_index] = code;
-            code = 1;
+            encoded_buffer[code_index] = 0xFF;
+            code_index = write_index++;
+        }
+
+        /*
+         * A run ended by a zero byte closes the block and consumes the zero.
+         */
+        else if (read_index < size)
+        {
+            encoded_buffer[code_index] = static_cast<uint8_t>(run + 1);
             code_index = write_index++;
             read_index++;
         }
+
+        /*
+         * Final update to code index once the source buffer is consumed.
+         */
         else
         {
-            /*
-             * Place current value in buffer into encoded buffer.
-             */
-            encoded_buffer[write_index++] = buffer[read_index++];
-            code++;
-
-            /*
-             * Update code index if code equals 255.
-             */
-            if (code == 0xFF)
-            {
-                encoded_buffer[code_index] = code;
-                code = 1;
-                code_index = write_index++;
-            }
+            encoded_buffer[code_index] = static_cast<uint8_t>(run + 1);
+            break;
         }
     }
 
-    /*
-     * Final update to code index.
-     */
-    encoded_buffer[code_index] = code;
-
     /*
      * Add trailing zero to mark the end of message.
      */ 
@@ -134,31 +253,29 @@ size_t cobs::decode(const uint8_t* encoded_buffer,
          * Return in failure if the input buffer is smaller than indicated
          * by the code count.
          */
-        if(size < read_index + code_count - 1)
+        size_t run = code_count - 1;
+        if(size < read_index + run)
         {
             return 0;
         }
 
         /*
-         * Loop through the code count - 1. The last element is the next 
-         * code count.
+         * If there is a zero inside the block, this is not a valid COBS
+         * frame.
          */
-        for(uint8_t count = 0; count < code_count - 1; count++)
+        if(find_zero(encoded_buffer + read_index, run) != run)
         {
-            uint8_t read_val = encoded_buffer[read_index++];
-
-            /*
-             * If the read value at this point is 0, this is not a valid 
-             * COBS frame.
-             */
-            if(read_val == 0)
-            {
-                return 0;
-            }
-
-            decoded_buffer[write_index++] = read_val;
+            return 0;
         }
 
+        /*
+         * Copy the block of nonzero bytes. The last element is the next
+         * code count.
+         */
+        memcpy(decoded_buffer + write_index, encoded_buffer + read_index, run);
+        write_index += run;
+        read_index += run;
+
         /*
          * If the code count is 255, then there is not a zero following 
          * the set of nonzero reads.
@@ -179,4 +296,277 @@ size_t cobs::decode(const uint8_t* encoded_buffer,
 size_t cobs::encoded_buffer_size(size_t unencoded_buffer_size)
 {
     return unencoded_buffer_size + unencoded_buffer_size / 254 + 1;
+}
+
+/*
+ * Default constructor for the streaming encoder. The encoder must be reset
+ * with an output buffer before it is used.
+ */
+cobs::encoder::encoder() :
+    encoded_buffer_(nullptr),
+    capacity_(0),
+    write_index_(1),
+    code_index_(0),
+    block_len_(0),
+    overflow_(false)
+{
+}
+
+/*
+ * Prepares the encoder for a new frame.
+ *
+ * @param encoded_buffer The buffer that encoded bytes are written to.
+ * @param capacity The capacity of the encoded buffer.
+ */
+void cobs::encoder::reset(uint8_t* encoded_buffer, size_t capacity)
+{
+    encoded_buffer_ = encoded_buffer;
+    capacity_ = capacity;
+    write_index_ = 1;
+    code_index_ = 0;
+    block_len_ = 0;
+    overflow_ = capacity < 2;
+}
+
+/*
+ * Encodes the next piece of a message. The output is identical to encoding
+ * the concatenation of every piece with cobs::encode.
+ *
+ * @param buffer The buffer containing the next piece of the message.
+ * @param size The length of the piece.
+ */
+void cobs::encoder::put(const uint8_t* buffer, size_t size)
+{
+    while(size > 0 && !overflow_)
+    {
+        /*
+         * Find the run of nonzero bytes that fits in the current block.
+         */
+        size_t room = 0xFE - block_len_;
+        size_t run = find_zero(buffer, size < room ? size : room);
+
+        /*
+         * Stop if the run, the next code byte and the delimiter would not
+         * fit in the encoded buffer.
+         */
+        if(write_index_ + run + 2 > capacity_)
+        {
+            overflow_ = true;
+            break;
+        }
+
+        memcpy(encoded_buffer_ + write_index_, buffer, run);
+        write_index_ += run;
+        block_len_ += run;
+        buffer += run;
+        size -= run;
+
+        /*
+         * A full block always starts a new block without consuming a zero.
+         */
+        if(block_len_ == 0xFE)
+        {
+            encoded_buffer_[code_index_] = 0xFF;
+            code_index_ = write_index_++;
+            block_len_ = 0;
+        }
+
+        /*
+         * A run ended by a zero byte closes the block and consumes the zero.
+         */
+        else if(size > 0)
+        {
+            encoded_buffer_[code_index_] = static_cast<uint8_t>(block_len_ + 1);
+            code_index_ = write_index_++;
+            block_len_ = 0;
+            buffer++;
+            size--;
+        }
+    }
+}
+
+/*
+ * Closes the last block and adds the trailing delimiter.
+ *
+ * @return The size of the encoded frame or 0 if it did not fit in the
+ * encoded buffer.
+ */
+size_t cobs::encoder::finish()
+{
+    if(overflow_)
+    {
+        return 0;
+    }
+
+    encoded_buffer_[code_index_] = static_cast<uint8_t>(block_len_ + 1);
+    encoded_buffer_[write_index_++] = 0;
+    return write_index_;
+}
+
+/*
+ * Default constructor for the streaming decoder. The decoder must be reset
+ * with an output buffer before it is fed.
+ */
+cobs::decoder::decoder() :
+    decoded_buffer_(nullptr),
+    capacity_(0),
+    size_(0),
+    block_remaining_(0),
+    is_zero_(false),
+    started_(false)
+{
+}
+
+/*
+ * Prepares the decoder for a new frame.
+ *
+ * @param decoded_buffer The buffer that decoded bytes are written to.
+ * @param capacity The capacity of the decoded buffer.
+ */
+void cobs::decoder::reset(uint8_t* decoded_buffer, size_t capacity)
+{
+    decoded_buffer_ = decoded_buffer;
+    capacity_ = capacity;
+    size_ = 0;
+    block_remaining_ = 0;
+    is_zero_ = false;
+    started_ = false;
+}
+
+/*
+ * Consumes one byte of an encoded frame. A zero byte is the frame
+ * delimiter. The frame is only valid if the delimiter arrives exactly at a
+ * block boundary, which matches the behavior of cobs::decode.
+ *
+ * @param encoded_byte The next byte of the encoded frame.
+ *
+ * @return DECODE_COMPLETE when the delimiter completes a valid frame,
+ * DECODE_ERROR if the frame is malformed, DECODE_OVERFLOW if it overflows
+ * the output buffer and DECODE_PENDING otherwise.
+ */
+cobs::decode_status cobs::decoder::feed(uint8_t encoded_byte)
+{
+    /*
+     * The delimiter completes the frame if no block is left unfinished.
+     */
+    if(encoded_byte == 0)
+    {
+        if(!started_ || block_remaining_ != 0)
+        {
+            return DECODE_ERROR;
+        }
+
+        return DECODE_COMPLETE;
+    }
+
+    /*
+     * A byte inside a block is copied to the output.
+     */
+    if(block_remaining_ != 0)
+    {
+        if(size_ == capacity_)
+        {
+            return DECODE_OVERFLOW;
+        }
+
+        decoded_buffer_[size_++] = encoded_byte;
+        block_remaining_--;
+        return DECODE_PENDING;
+    }
+
+    /*
+     * Otherwise this is a code byte. Emit the zero implied by the previous
+     * block and start a new block.
+     */
+    if(is_zero_)
+    {
+        if(size_ == capacity_)
+        {
+            return DECODE_OVERFLOW;
+        }
+
+        decoded_buffer_[size_++] = 0;
+    }
+
+    block_remaining_ = encoded_byte - 1;
+    is_zero_ = encoded_byte != 0xFF;
+    started_ = true;
+    return DECODE_PENDING;
+}
+
+/*
+ * Consumes a chunk of an encoded frame. Runs of data bytes are searched for
+ * the delimiter and copied a block at a time. Decoding stops right after
+ * the delimiter, so any bytes after it are left for the next frame.
+ *
+ * @param encoded_buffer The buffer containing the next part of the frame.
+ * @param size The length of the chunk.
+ * @param consumed Set to the number of bytes consumed from the chunk.
+ *
+ * @return The same status feeding the consumed bytes one at a time would
+ * have returned for the last of them.
+ */
+cobs::decode_status cobs::decoder::feed(const uint8_t* encoded_buffer,
+                                        size_t size,
+                                        size_t& consumed)
+{
+    size_t read_index = 0;
+
+    while(read_index < size)
+    {
+        /*
+         * Copy as much of the current block as is available, stopping early
+         * at a delimiter.
+         */
+        if(block_remaining_ != 0)
+        {
+            size_t run = size - read_index;
+            if(run > block_remaining_)
+            {
+                run = block_remaining_;
+            }
+
+            run = find_zero(encoded_buffer + read_index, run);
+
+            if(size_ + run > capacity_)
+            {
+                consumed = read_index + run;
+                return DECODE_OVERFLOW;
+            }
+
+            memcpy(decoded_buffer_ + size_, encoded_buffer + read_index, run);
+            size_ += run;
+            read_index += run;
+            block_remaining_ -= static_cast<uint8_t>(run);
+
+            if(read_index == size)
+            {
+                break;
+            }
+        }
+
+        /*
+         * The next byte is either a code byte or a delimiter.
+         */
+        decode_status status = feed(encoded_buffer[read_index++]);
+
+        if(status != DECODE_PENDING)
+        {
+            consumed = read_index;
+            return status;
+        }
+    }
+
+    consumed = read_index;
+    return DECODE_PENDING;
+}
+
+/*
+ * Returns the number of decoded bytes written so far.
+ *
+ * @return The number of decoded bytes.
+ */
+size_t cobs::decoder::size()
+{
+    return size_;
 }
\ No newline at end of file
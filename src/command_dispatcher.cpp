@@ -0,0 +1,252 @@
+/*
+ * Implementation of command_dispatcher class.
+ */
+
+#include <cstring>
+#include "command_dispatcher.h"
+#include "serial_frame.h"
+
+/*
+ * Constructor for a dispatcher with no handlers.
+ */
+command_dispatcher::command_dispatcher() :
+    page_count(0),
+    handler_count(1)
+{
+    memset(page_index, 0, sizeof(page_index));
+    handlers[0].handler = nullptr;
+    handlers[0].source = nullptr;
+    handlers[0].context = nullptr;
+}
+
+/*
+ * Registers a handler for a single address.
+ *
+ * @param address The address of the command without the read flag.
+ * @param read True to handle read requests, false to handle writes.
+ * @param handler The function called for matching commands.
+ * @param context Pointer passed to the handler.
+ * @return True if the handler was registered.
+ */
+bool command_dispatcher::add(uint16_t address,
+                             bool read,
+                             command_handler handler,
+                             void *context)
+{
+    return add_range(address, address, read, handler, context);
+}
+
+/*
+ * Registers a handler for every address from first to last inclusive.
+ * Registering an address again replaces its handler.
+ *
+ * @param first The first address of the range without the read flag.
+ * @param last The last address of the range without the read flag.
+ * @param read True to handle read requests, false to handle writes.
+ * @param handler The function called for matching commands.
+ * @param context Pointer passed to the handler.
+ * @return True if the handler was registered for the whole range.
+ */
+bool command_dispatcher::add_range(uint16_t first,
+                                   uint16_t last,
+                                   bool read,
+                                   command_handler handler,
+                                   void *context)
+{
+    if(handler == nullptr)
+    {
+        return false;
+    }
+
+    handler_entry entry = { handler, nullptr, context };
+    return add_entry(first, last, read, entry);
+}
+
+/*
+ * Registers a value source that answers read requests for a single address.
+ *
+ * @param address The address of the read request without the read flag.
+ * @param source The function that supplies the reply.
+ * @param context Pointer passed to the source.
+ * @return True if the source was registered.
+ */
+bool command_dispatcher::add_source(uint16_t address,
+                                    value_source source,
+                                    void *context)
+{
+    return add_source_range(address, address, source, context);
+}
+
+/*
+ * Registers a value source that answers read requests for every address from
+ * first to last inclusive. Registering an address again replaces its source.
+ *
+ * @param first The first address of the range without the read flag.
+ * @param last The last address of the range without the read flag.
+ * @param source The function that supplies the reply.
+ * @param context Pointer passed to the source.
+ * @return True if the source was registered for the whole range.
+ */
+bool command_dispatcher::add_source_range(uint16_t first,
+                                          uint16_t last,
+                                          value_source source,
+                                          void *context)
+{
+    if(source == nullptr)
+    {
+        return false;
+    }
+
+    handler_entry entry = { nullptr, source, context };
+    return add_entry(first, last, true, entry);
+}
+
+/*
+ * Points every address from first to last inclusive at a handler entry.
+ *
+ * @return True if the entry was registered for the whole range.
+ */
+bool command_dispatcher::add_entry(uint16_t first,
+                                   uint16_t last,
+                                   bool read,
+                                   const handler_entry &entry)
+{
+    if(first > last || last > 0x7FFF)
+    {
+        return false;
+    }
+
+    uint8_t index = handler_index(entry);
+    if(index == 0)
+    {
+        return false;
+    }
+
+    uint16_t read_flag = read ? 0x8000 : 0;
+
+    for(uint32_t address = first; address <= last; address++)
+    {
+        uint16_t key = static_cast<uint16_t>(address | read_flag);
+        uint8_t *entries = page(key >> 8);
+
+        if(entries == nullptr)
+        {
+            return false;
+        }
+
+        entries[key & 0xFF] = index;
+    }
+
+    return true;
+}
+
+/*
+ * Calls the handler registered for the address of a command. If a value
+ * source is registered instead, its reply is placed into the reply queue.
+ *
+ * @param command The received command.
+ * @param replies The queue replies from value sources are placed into, or
+ * null to leave read requests with a value source unhandled.
+ * @return True if a handler consumed the command or a reply was queued.
+ */
+bool command_dispatcher::dispatch(serial_command &command,
+                                  abstract_queue<serial_command> *replies)
+{
+    uint8_t page_num = page_index[command.address >> 8];
+
+    if(page_num == 0)
+    {
+        return false;
+    }
+
+    uint8_t index = pages[page_num - 1][command.address & 0xFF];
+
+    if(index == 0)
+    {
+        return false;
+    }
+
+    handler_entry &entry = handlers[index];
+
+    if(entry.handler != nullptr)
+    {
+        return entry.handler(command, entry.context);
+    }
+
+    /*
+     * Build the reply in place in the reply queue. If the queue is full or
+     * the source has no value, the request falls through to the receive
+     * queue instead.
+     */
+    if(replies == nullptr || !replies->reserve(1))
+    {
+        return false;
+    }
+
+    /*
+     * The reserved slot holds whatever command used it last, so every field
+     * the source may leave alone is reset. Replies are not timestamped.
+     */
+    serial_command &reply = replies->reserved(0);
+    reply.address = command.address;
+    reply.payload_size = 0;
+    reply.timestamp = 0;
+
+    if(!entry.source(reply, entry.context) ||
+       reply.payload_size > serial_command::MAX_COMMAND_LEN)
+    {
+        replies->commit(0);
+        return false;
+    }
+
+    return replies->commit(1);
+}
+
+/*
+ * Finds the index of a handler entry, adding it if it has not been
+ * registered before.
+ *
+ * @return The handler index, or 0 if the handler table is full.
+ */
+uint8_t command_dispatcher::handler_index(const handler_entry &entry)
+{
+    for(size_t i = 1; i < handler_count; i++)
+    {
+        if(handlers[i].handler == entry.handler &&
+           handlers[i].source == entry.source &&
+           handlers[i].context == entry.context)
+        {
+            return static_cast<uint8_t>(i);
+        }
+    }
+
+    if(handler_count > MAX_HANDLERS)
+    {
+        return 0;
+    }
+
+    handlers[handler_count] = entry;
+    return static_cast<uint8_t>(handler_count++);
+}
+
+/*
+ * Returns the handler indices of a page, allocating the page if needed.
+ *
+ * @param page_num The high byte of the addresses in the page.
+ * @return The page, or nullptr if every page is already allocated.
+ */
+uint8_t *command_dispatcher::page(uint8_t page_num)
+{
+    if(page_index[page_num] == 0)
+    {
+        if(page_count == MAX_PAGES)
+        {
+            return nullptr;
+        }
+
+        memset(pages[page_count], 0, sizeof(pages[page_count]));
+        page_index[page_num] = static_cast<uint8_t>(++page_count);
+    }
+
+    return pages[page_index[page_num] - 1];
+}
@@ -1,6 +1,9 @@
 /*
  * This computes the CRC-CCITT checksum for an array.
- * Taken from https://github.com/CANopenNode/CANopenNode/blob/master/stack/crc16-ccitt.c
+ * The byte-at-a-time version is taken from 
+ * https://github.com/CANopenNode/CANopenNode/blob/master/stack/crc16-ccitt.c
+ * The slice-by-4 and slice-by-8 versions consume several bytes per table
+ * round using additional tables generated at compile time.
  *
  * @date 10/13/2019
  * @author Janez Paternoster, John Sauer
@@ -9,22 +12,161 @@
 #include "crc16.h"
 
 /*
- * Computes the CRC-CCITT checksum of an array.
- *
- * @param data_p The data being checksummed.
- * @param length The length of the data being checksummed.
- *
- * @return The CRC-CCITT checksum of the data.
+ * Lookup tables for CRC16-CCITT calculation. Slice 0 is the classic
+ * byte-at-a-time table.
+ */
+static constexpr crc::crc16_tables<8> ccitt_tables =
+  crc::generate_crc16_tables<crc::CCITT_POLY, 8>();
+
+/*
+ * Spot check the generated tables against the published CCITT table.
+ */
+static_assert(ccitt_tables.entries[0x01] == 0x1021U &&
+              ccitt_tables.entries[0x80] == 0x9188U &&
+              ccitt_tables.entries[0xFF] == 0x1EF0U,
+              "CRC16-CCITT table generation is wrong");
+
+/*
+ * Returns entry i of slice table k.
  */
-uint16_t crc::crc16(uint8_t *data, size_t length)
+static inline uint16_t slice(size_t k, uint16_t i)
 {
-    uint16_t crc = 0xFFFF;
+    return ccitt_tables.entries[k * 256 + i];
+}
 
+/*
+ * Advances a CRC register over an array one byte at a time.
+ */
+static uint16_t update_bytewise(uint16_t crc, const uint8_t *data, size_t length)
+{
     for(size_t i = 0; i < length; i++)
     {
         uint16_t tmp = (crc >> 8) ^ (uint16_t) data[i];
-        crc = ((uint16_t)(crc << 8)) ^ crc::crc16_ccitt_table[tmp];
+        crc = ((uint16_t)(crc << 8)) ^ slice(0, tmp);
     }
 
     return crc;
+}
+
+/*
+ * Advances a CRC register over an array four bytes at a time. The first
+ * two bytes of each group are folded into the register, which then fully
+ * shifts out over the group.
+ */
+static uint16_t update_slice4(uint16_t crc, const uint8_t *data, size_t length)
+{
+    size_t i = 0;
+
+    for(; i + 4 <= length; i += 4)
+    {
+        crc ^= static_cast<uint16_t>((data[i] << 8) | data[i + 1]);
+        crc = slice(3, crc >> 8) ^ slice(2, crc & 0xFF) ^
+              slice(1, data[i + 2]) ^ slice(0, data[i + 3]);
+    }
+
+    return update_bytewise(crc, data + i, length - i);
+}
+
+/*
+ * Advances a CRC register over an array eight bytes at a time.
+ */
+static uint16_t update_slice8(uint16_t crc, const uint8_t *data, size_t length)
+{
+    size_t i = 0;
+
+    for(; i + 8 <= length; i += 8)
+    {
+        crc ^= static_cast<uint16_t>((data[i] << 8) | data[i + 1]);
+        crc = slice(7, crc >> 8) ^ slice(6, crc & 0xFF) ^
+              slice(5, data[i + 2]) ^ slice(4, data[i + 3]) ^
+              slice(3, data[i + 4]) ^ slice(2, data[i + 5]) ^
+              slice(1, data[i + 6]) ^ slice(0, data[i + 7]);
+    }
+
+    return update_bytewise(crc, data + i, length - i);
+}
+
+/*
+ * Resets a running checksum to the CRC-CCITT initial value.
+ */
+void crc::crc16_state::init()
+{
+    value = 0xFFFF;
+}
+
+/*
+ * Adds the next piece of data to a running checksum.
+ *
+ * @param data The data being checksummed.
+ * @param length The length of the data being checksummed.
+ */
+void crc::crc16_state::update(const uint8_t *data, size_t length)
+{
+    value = update_slice8(value, data, length);
+}
+
+/*
+ * Returns the CRC-CCITT checksum of all data added since init.
+ *
+ * @return The CRC-CCITT checksum of the data.
+ */
+uint16_t crc::crc16_state::finalize()
+{
+    return value;
+}
+
+/*
+ * Computes the CRC-CCITT checksum of an array with the fastest available
+ * variant.
+ *
+ * @param data The data being checksummed.
+ * @param length The length of the data being checksummed.
+ *
+ * @return The CRC-CCITT checksum of the data.
+ */
+uint16_t crc::crc16(const uint8_t *data, size_t length)
+{
+    crc16_state state;
+    state.init();
+    state.update(data, length);
+    return state.finalize();
+}
+
+/*
+ * Computes the CRC-CCITT checksum of an array one byte at a time.
+ *
+ * @param data The data being checksummed.
+ * @param length The length of the data being checksummed.
+ *
+ * @return The CRC-CCITT checksum of the data.
+ */
+uint16_t crc::crc16_bytewise(const uint8_t *data, size_t length)
+{
+    return update_bytewise(0xFFFF, data, length);
+}
+
+/*
+ * Computes the CRC-CCITT checksum of an array four bytes at a time.
+ *
+ * @param data The data being checksummed.
+ * @param length The length of the data being checksummed.
+ *
+ * @return The CRC-CCITT checksum of the data.
+ */
+uint16_t crc::crc16_slice4(const uint8_t *data, size_t length)
+{
+    return update_slice4(0xFFFF, data, length);
+}
+
+/*
+ * Computes the CRC-CCITT checksum of an array eight bytes at a time.
+ *
+ * @param data The data being checksummed.
+ * @param length The length of the data being checksummed.
+ *
+ * @return The CRC-CCITT checksum of the data.
+ */
+uint16_t crc::crc16_slice8(const uint8_t *data, size_t length)
+{
+    return update_slice8(0xFFFF, data, length);
 }
\ No newline at end of file
@@ -0,0 +1,208 @@
+/*
+ * Implementation of latency_histogram class.
+ */
+
+#include <cstdio>
+#include "latency_histogram.h"
+
+/*
+ * Constructor for an empty histogram.
+ */
+latency_histogram::latency_histogram()
+{
+    reset();
+}
+
+/*
+ * Adds a value to its bucket.
+ *
+ * @param value The latency, in microseconds.
+ */
+void latency_histogram::record(uint32_t value)
+{
+    size_t index = bucket_index(value);
+    buckets[index].store(buckets[index].load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+    count_.store(count_.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+
+    if(value > max_.load(std::memory_order_relaxed))
+    {
+        max_.store(value, std::memory_order_relaxed);
+    }
+}
+
+/*
+ * Empties the histogram.
+ */
+void latency_histogram::reset()
+{
+    for(size_t i = 0; i < BUCKETS; i++)
+    {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    count_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+/*
+ * Returns the number of values recorded.
+ *
+ * @return The number of values recorded.
+ */
+uint32_t latency_histogram::count()
+{
+    return count_.load(std::memory_order_relaxed);
+}
+
+/*
+ * Returns the largest value recorded.
+ *
+ * @return The largest value recorded, or 0 if the histogram is empty.
+ */
+uint32_t latency_histogram::max()
+{
+    return max_.load(std::memory_order_relaxed);
+}
+
+/*
+ * Returns the value below which a fraction of the recorded values lie.
+ *
+ * @param per_mille The fraction, in thousandths. 500 is the median and 990
+ * the 99th percentile.
+ *
+ * @return The highest value of the bucket the percentile falls in, capped
+ * at the largest value recorded, or 0 if the histogram is empty.
+ */
+uint32_t latency_histogram::percentile(uint32_t per_mille)
+{
+    /*
+     * Total the buckets instead of using count_. Values recorded while the
+     * buckets are walked can only make the walk reach the rank sooner.
+     */
+    uint64_t total = 0;
+
+    for(size_t i = 0; i < BUCKETS; i++)
+    {
+        total += bucket(i);
+    }
+
+    if(total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (total * per_mille + 999) / 1000;
+    if(rank == 0)
+    {
+        rank = 1;
+    }
+
+    uint32_t highest = max();
+    uint64_t seen = 0;
+
+    for(size_t i = 0; i < BUCKETS; i++)
+    {
+        seen += bucket(i);
+
+        if(seen >= rank)
+        {
+            uint32_t upper = i + 1 < BUCKETS ? bucket_floor(i + 1) - 1 : UINT32_MAX;
+            return upper < highest ? upper : highest;
+        }
+    }
+
+    return highest;
+}
+
+/*
+ * Returns the number of values recorded in a bucket.
+ *
+ * @param index The bucket, below BUCKETS.
+ *
+ * @return The number of values in the bucket.
+ */
+uint32_t latency_histogram::bucket(size_t index)
+{
+    return buckets[index].load(std::memory_order_relaxed);
+}
+
+/*
+ * Writes the histogram as one line of text: the count, p50, p99 and max
+ * followed by floor:count pairs of the nonempty buckets.
+ *
+ * @param buf The buffer the text is written to.
+ * @param len The capacity of the buffer.
+ *
+ * @return The length of the text, which is truncated to fit the buffer.
+ */
+int latency_histogram::format(char *buf, size_t len)
+{
+    if(len == 0)
+    {
+        return 0;
+    }
+
+    size_t pos = snprintf(buf, len, "n=%lu p50=%lu p99=%lu max=%lu",
+                          static_cast<unsigned long>(count()),
+                          static_cast<unsigned long>(percentile(500)),
+                          static_cast<unsigned long>(percentile(990)),
+                          static_cast<unsigned long>(max()));
+
+    for(size_t i = 0; i < BUCKETS && pos < len; i++)
+    {
+        uint32_t n = bucket(i);
+
+        if(n != 0)
+        {
+            pos += snprintf(buf + pos, len - pos, " %lu:%lu",
+                            static_cast<unsigned long>(bucket_floor(i)),
+                            static_cast<unsigned long>(n));
+        }
+    }
+
+    return static_cast<int>(pos < len ? pos : len - 1);
+}
+
+/*
+ * Returns the bucket a value is counted in.
+ *
+ * @param value The value.
+ *
+ * @return The index of the bucket.
+ */
+size_t latency_histogram::bucket_index(uint32_t value)
+{
+    if(value < SUB_BUCKETS)
+    {
+        return value;
+    }
+
+    /*
+     * The top SUB_BUCKET_BITS + 1 bits of the value pick the bucket within
+     * its power of two.
+     */
+    uint32_t exponent = 31 - __builtin_clz(value);
+    uint32_t sub = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+/*
+ * Returns the smallest value counted in a bucket.
+ *
+ * @param index The bucket, below BUCKETS.
+ *
+ * @return The smallest value of the bucket.
+ */
+uint32_t latency_histogram::bucket_floor(size_t index)
+{
+    if(index < SUB_BUCKETS)
+    {
+        return static_cast<uint32_t>(index);
+    }
+
+    uint32_t exponent = static_cast<uint32_t>(index / SUB_BUCKETS) + SUB_BUCKET_BITS - 1;
+    uint32_t sub = static_cast<uint32_t>(index % SUB_BUCKETS);
+    return (SUB_BUCKETS + sub) << (exponent - SUB_BUCKET_BITS);
+}
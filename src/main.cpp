@@ -4,8 +4,9 @@
  * @author John Sauer
  * @date 10/14/2019
  */
+#include <cstdio>
 #include "vex.h"
-#include "serial_thread.h"
+#include "serial_manager.h"
 
 /*
  * Port number used for serial communication.
@@ -17,24 +18,33 @@ constexpr int32_t port = 19;
  */
 constexpr int32_t baudrate = 256000;
 
+/*
+ * Number of main loop iterations between latency reports on the console.
+ */
+constexpr uint32_t report_period = 100;
+
+/*
+ * Names of the latency stages in console reports.
+ */
+const char *const latency_names[LATENCY_STAGES] =
+{
+    "rx_frame", "rx_decode", "queue_wait", "turnaround"
+};
+
 /*
  * A global instance of vex::brain.
  */
 vex::brain brain;
 
 /*
- * Serial thread object.
+ * Serial port object.
  */
-serial_thread port20_serial;
+sized_serial_port<4096, 4096, 1024> port20_serial;
 
 /*
- * Callback function for serial thread.
+ * Serial manager that services every serial port from one thread.
  */
-int serial20_callback()
-{
-    port20_serial.serial_routine();
-    return 0;
-}
+serial_manager ser_manager;
 
 /*
  * Main application function.
@@ -42,20 +52,42 @@ int serial20_callback()
 int main() {
 
     /*
-     * Initialize serial thread.
+     * Register serial ports and start the serial thread.
      */
-    port20_serial.init(brain, port, baudrate, serial20_callback);
+    ser_manager.add(port20_serial, port, baudrate);
+    ser_manager.init(brain, ROUND_ROBIN);
 
     /*
      * Loop forever, printing serial statistics and clearing receive command
-     * queue.
+     * queue. Latency histograms are written to the console now and then so
+     * they can be collected over USB.
      */
+    char report[512];
+    uint32_t iteration = 0;
+
     while(true)
     {
         brain.Screen.printAt( 10, 25, "Rx frames: %d", port20_serial.rx_frames() );
         brain.Screen.printAt( 10, 50, "Tx frames: %d", port20_serial.tx_frames() );
         brain.Screen.printAt( 10, 75, "Rx errors: %d", port20_serial.rx_errors() );
         brain.Screen.printAt( 10, 100, "Tx errors: %d", port20_serial.tx_errors() );
+        brain.Screen.printAt( 10, 125, "Turnaround: %d us", port20_serial.turnaround_us() );
+        brain.Screen.printAt( 10, 150, "Baud: %d", port20_serial.baudrate() );
+
+        latency_histogram &turnaround = port20_serial.latency(LATENCY_TURNAROUND);
+        brain.Screen.printAt( 10, 175, "p50/p99/max: %d/%d/%d us",
+                              turnaround.percentile(500),
+                              turnaround.percentile(990),
+                              turnaround.max() );
+
+        if(++iteration % report_period == 0)
+        {
+            for(size_t i = 0; i < LATENCY_STAGES; i++)
+            {
+                port20_serial.latency(static_cast<latency_stage>(i)).format(report, sizeof(report));
+                printf("port20 %s %s\n", latency_names[i], report);
+            }
+        }
 
         port20_serial.rx_queue().clear();
         
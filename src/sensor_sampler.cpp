@@ -0,0 +1,307 @@
+/*
+ * Implementation of sensor_sampler class.
+ */
+
+#include "sensor_sampler.h"
+#include "serial_frame.h"
+
+/*
+ * Returns true if timestamp a is before timestamp b. Handles the system
+ * timer wrapping around.
+ */
+static bool time_before(uint32_t a, uint32_t b)
+{
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+/*
+ * Constructor for sampler with no channels.
+ */
+sensor_sampler::sensor_sampler() :
+    brain_ptr(nullptr),
+    source_base(0),
+    channel_count(0)
+{
+}
+
+/*
+ * Adds a channel sampling the position, velocity and current of a motor.
+ * This must be called before init.
+ *
+ * @param port The smart port of the motor. The range of allowable values is
+ * 0 (Port 1) to 20 (Port 21).
+ * @param period_ms The sampling period, in milliseconds.
+ * @return The channel number, or -1 if no channel is left.
+ */
+int32_t sensor_sampler::add_motor(int32_t port, uint32_t period_ms)
+{
+    return add_channel(SENSOR_MOTOR, port, 0, period_ms);
+}
+
+/*
+ * Adds a channel sampling one of the Brain's ADI ports. This must be called
+ * before init.
+ *
+ * @param adi_port The ADI port. The range of allowable values is 0 (Port A)
+ * to 7 (Port H).
+ * @param period_ms The sampling period, in milliseconds.
+ * @return The channel number, or -1 if no channel is left.
+ */
+int32_t sensor_sampler::add_adi(uint32_t adi_port, uint32_t period_ms)
+{
+    return add_channel(SENSOR_ADI, BRAIN_ADI_INDEX, adi_port, period_ms);
+}
+
+/*
+ * Adds a channel sampling the heading of an inertial sensor. This must be
+ * called before init.
+ *
+ * @param port The smart port of the inertial sensor. The range of allowable
+ * values is 0 (Port 1) to 20 (Port 21).
+ * @param period_ms The sampling period, in milliseconds.
+ * @return The channel number, or -1 if no channel is left.
+ */
+int32_t sensor_sampler::add_imu(int32_t port, uint32_t period_ms)
+{
+    return add_channel(SENSOR_IMU, port, 0, period_ms);
+}
+
+/*
+ * Adds a channel to the table.
+ *
+ * @return The channel number, or -1 if no channel is left.
+ */
+int32_t sensor_sampler::add_channel(sensor_kind kind,
+                                    int32_t port,
+                                    uint32_t adi_port,
+                                    uint32_t period_ms)
+{
+    if(channel_count == MAX_CHANNELS)
+    {
+        return -1;
+    }
+
+    sensor_channel &channel = channels[channel_count];
+    channel.kind = kind;
+    channel.device = vexDeviceGetByIndex(port);
+    channel.adi_port = adi_port;
+    channel.period_ms = period_ms == 0 ? 1 : period_ms;
+    channel.next_sample = 0;
+
+    return static_cast<int32_t>(channel_count++);
+}
+
+/*
+ * Registers the snapshot table as the value source for read requests. Value
+ * i of channel c is answered at base_address + c * ADDRESS_STRIDE + i with
+ * an 8 byte payload: the value as a big endian IEEE 754 float followed by
+ * the big endian sample timestamp in milliseconds. This must be called after
+ * every channel is added and before the serial task starts.
+ *
+ * @param dispatcher The dispatcher of the serial port answering the reads.
+ * @param base_address The address of the first value of channel 0.
+ * @return True if the sources were registered. The addresses of every
+ * channel must lie below the link control addresses.
+ */
+bool sensor_sampler::add_sources(command_dispatcher &dispatcher,
+                                 uint16_t base_address)
+{
+    if(channel_count == 0)
+    {
+        return false;
+    }
+
+    source_base = base_address;
+    uint32_t last = base_address + channel_count * ADDRESS_STRIDE - 1;
+
+    if(last >= serial_frame_handler::LINK_ADDRESS_BASE)
+    {
+        return false;
+    }
+
+    return dispatcher.add_source_range(base_address,
+                                       static_cast<uint16_t>(last),
+                                       value_source,
+                                       this);
+}
+
+/*
+ * Starts the thread that samples every channel.
+ *
+ * @param brain The VEX Brain object.
+ */
+void sensor_sampler::init(vex::brain &brain)
+{
+    brain_ptr = &brain;
+    terminated.set_value(false);
+
+    /*
+     * Create sampler thread and detach it.
+     */
+    sampler_thread = vex::task(task_entry, this);
+}
+
+/*
+ * This function signals the sampler routine to end.
+ */
+void sensor_sampler::destroy()
+{
+    terminated.set_value(true);
+}
+
+/*
+ * Copies out the latest sample of a channel.
+ *
+ * @param channel The channel number.
+ * @param snapshot The latest sample.
+ * @return True if the channel exists.
+ */
+bool sensor_sampler::read(size_t channel, sensor_snapshot &snapshot)
+{
+    if(channel >= channel_count)
+    {
+        return false;
+    }
+
+    snapshot = channels[channel].snapshot.load();
+    return true;
+}
+
+/*
+ * Thread entry point that runs the sampler routine of the sensor sampler
+ * passed as the argument.
+ *
+ * @param arg Pointer to the sensor sampler.
+ * @return Always 0.
+ */
+int sensor_sampler::task_entry(void *arg)
+{
+    static_cast<sensor_sampler*>(arg)->sampler_routine();
+    return 0;
+}
+
+/*
+ * Queries the device of a channel and publishes the sample.
+ *
+ * @param channel The channel number.
+ * @param now The current system time, in milliseconds.
+ */
+void sensor_sampler::sample(size_t channel, uint32_t now)
+{
+    sensor_channel &ch = channels[channel];
+    sensor_snapshot snapshot;
+    snapshot.timestamp = now;
+
+    for(size_t i = 0; i < sensor_snapshot::MAX_VALUES; i++)
+    {
+        snapshot.values[i] = 0;
+    }
+
+    switch(ch.kind)
+    {
+        case SENSOR_MOTOR:
+        {
+            snapshot.values[0] = static_cast<float>(vexDeviceMotorPositionGet(ch.device));
+            snapshot.values[1] = static_cast<float>(vexDeviceMotorVelocityGet(ch.device));
+            snapshot.values[2] = static_cast<float>(vexDeviceMotorCurrentGet(ch.device));
+            break;
+        }
+        case SENSOR_ADI:
+        {
+            snapshot.values[0] = static_cast<float>(vexDeviceAdiValueGet(ch.device,
+                                                                         ch.adi_port));
+            break;
+        }
+        case SENSOR_IMU:
+        {
+            snapshot.values[0] = static_cast<float>(vexDeviceImuHeadingGet(ch.device));
+            break;
+        }
+    }
+
+    ch.snapshot.store(snapshot);
+}
+
+/*
+ * Function that runs in separate thread that samples every channel when it
+ * is due and sleeps until the next channel is due.
+ */
+void sensor_sampler::sampler_routine()
+{
+    uint32_t now = brain_ptr->Timer.system();
+
+    for(size_t i = 0; i < channel_count; i++)
+    {
+        channels[i].next_sample = now;
+    }
+
+    while(!terminated.get_value())
+    {
+        now = brain_ptr->Timer.system();
+        uint32_t wake_time = now + 1;
+
+        for(size_t i = 0; i < channel_count; i++)
+        {
+            sensor_channel &ch = channels[i];
+
+            if(!time_before(now, ch.next_sample))
+            {
+                sample(i, now);
+
+                /*
+                 * Keep a fixed rate, but do not try to catch up on samples
+                 * that were missed.
+                 */
+                ch.next_sample += ch.period_ms;
+                if(!time_before(now, ch.next_sample))
+                {
+                    ch.next_sample = now + ch.period_ms;
+                }
+            }
+
+            if(i == 0 || time_before(ch.next_sample, wake_time))
+            {
+                wake_time = ch.next_sample;
+            }
+        }
+
+        vex::this_thread::sleep_until(wake_time);
+    }
+}
+
+/*
+ * Value source answering read requests from the snapshot table.
+ *
+ * @param reply The reply to fill in.
+ * @param context Pointer to the sensor sampler.
+ * @return True if the address names a sampled value.
+ */
+bool sensor_sampler::value_source(serial_command &reply, void *context)
+{
+    sensor_sampler *sampler = static_cast<sensor_sampler*>(context);
+    uint16_t offset = (reply.address & 0x7FFF) - sampler->source_base;
+    size_t channel = offset / ADDRESS_STRIDE;
+    size_t value = offset % ADDRESS_STRIDE;
+
+    sensor_snapshot snapshot;
+    if(value >= sensor_snapshot::MAX_VALUES ||
+       !sampler->read(channel, snapshot))
+    {
+        return false;
+    }
+
+    uint32_t bits;
+    memcpy(&bits, &snapshot.values[value], sizeof(bits));
+
+    reply.payload_size = 8;
+    reply.data[0] = static_cast<uint8_t>(bits >> 24);
+    reply.data[1] = static_cast<uint8_t>(bits >> 16);
+    reply.data[2] = static_cast<uint8_t>(bits >> 8);
+    reply.data[3] = static_cast<uint8_t>(bits);
+    reply.data[4] = static_cast<uint8_t>(snapshot.timestamp >> 24);
+    reply.data[5] = static_cast<uint8_t>(snapshot.timestamp >> 16);
+    reply.data[6] = static_cast<uint8_t>(snapshot.timestamp >> 8);
+    reply.data[7] = static_cast<uint8_t>(snapshot.timestamp);
+
+    return true;
+}
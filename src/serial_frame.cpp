@@ -5,6 +5,7 @@
  * @date 10/14/2019
  */
  
+#include <cstring>
 #include "serial_frame.h"
 
 /*
@@ -12,7 +13,8 @@
  */
 serial_command::serial_command() : 
   payload_size(0),
-  address(0)
+  address(0),
+  timestamp(0)
 {
 }
 
@@ -26,6 +28,7 @@ serial_command::serial_command(const serial_command &old)
      */
     payload_size = old.payload_size;
     address = old.address;
+    timestamp = old.timestamp;
 
     /*
      * Copy each byte in the payload.
@@ -36,6 +39,23 @@ serial_command::serial_command(const serial_command &old)
     }
 }
 
+/*
+ * Copy assignment for serial_command. This deep copies the command.
+ */
+serial_command &serial_command::operator=(const serial_command &old)
+{
+    payload_size = old.payload_size;
+    address = old.address;
+    timestamp = old.timestamp;
+
+    for(size_t i = 0; i < payload_size; i++)
+    {
+        data[i] = old.data[i];
+    }
+
+    return *this;
+}
+
 /*
  * Default destructor for serial_command.
  */
@@ -49,7 +69,7 @@ serial_command::~serial_command()
  *
  * @return The checksum of the command.
  */
-uint8_t serial_command::checksum()
+uint8_t serial_command::checksum() const
 {
     /*
      * Add bytes from payload size and address.
@@ -75,7 +95,7 @@ uint8_t serial_command::checksum()
  *
  * @return True if the command is a read request.
  */
-bool serial_command::is_read()
+bool serial_command::is_read() const
 {
     return (address & 0x8000) != 0;
 }
@@ -91,17 +111,23 @@ bool serial_command::is_read()
  * @param buf The buffer containing the serial frame.
  * @param len The length of the buffer containing the serial frame.
  * @param queue The queue that parsed commands are placed into.
+ * @param dispatcher If not null, commands with a registered handler are
+ * passed to it instead of being placed into the queue.
+ * @param replies The queue that replies to read requests answered by the
+ * dispatcher are placed into.
  *
  * @return True if parsing is successful.
  */
 bool serial_frame_handler::buf2queue(uint8_t *buf,
                                      size_t len,
-                                     abstract_queue<serial_command> &queue)
+                                     abstract_queue<serial_command> &queue,
+                                     command_dispatcher *dispatcher,
+                                     abstract_queue<serial_command> *replies)
 {
     /*
-     * Immediately return if buffer is empty.
+     * Immediately return if buffer is too short to hold a frame.
      */
-    if(len == 0)
+    if(len < 4)
     {
         return false;
     }
@@ -121,10 +147,38 @@ bool serial_frame_handler::buf2queue(uint8_t *buf,
         return false;
     }
 
+    return commands2queue(buf, len, queue, dispatcher, replies) == PARSE_OK;
+}
+
+/*
+ * Parses the commands of a v1 frame into reserved slots of a queue. On
+ * failure the reservation is abandoned.
+ *
+ * @param buf The buffer containing the serial frame.
+ * @param len The length of the frame, including the CRC.
+ * @param queue The queue that parsed commands are placed into.
+ * @param command_num The number of commands parsed into the reservation.
+ *
+ * @return PARSE_OK if parsing is successful, otherwise the reason it failed.
+ */
+static serial_frame_handler::parse_status parse_v1(const uint8_t *buf,
+                     size_t len,
+                     abstract_queue<serial_command> &queue,
+                     uint16_t &command_num)
+{
     /*
      * The number of commands to parse is the first 2 bytes of the frame.
      */
-    uint16_t command_num = (buf[0] << 8) | buf[1];
+    command_num = (buf[0] << 8) | buf[1];
+
+    /*
+     * Reserve space for every command in the frame up front so the frame is
+     * either enqueued completely or not at all.
+     */
+    if(!queue.reserve(command_num))
+    {
+        return serial_frame_handler::PARSE_QUEUE_FULL;
+    }
 
     /*
      * The starting index where serial commands are parsed from is offset by 2
@@ -143,22 +197,25 @@ bool serial_frame_handler::buf2queue(uint8_t *buf,
          */
         if(command_index + 3 >= len - 2)
         {
-            return false;
+            queue.commit(0);
+            return serial_frame_handler::PARSE_MALFORMED;
         }
 
         /*
-         * Create a new command object and set the payload length and
-         * address from data in the frame.
+         * Parse the payload length and address from the frame directly into
+         * the reserved queue slot.
          */
-        serial_command command;
+        serial_command &command = queue.reserved(i);
         command.payload_size = buf[command_index++];
+        command.timestamp = 0;
 
         /*
          * Return in failure if indicated payload length is too long.
          */
         if(command.payload_size > 8)
         {
-            return false;
+            queue.commit(0);
+            return serial_frame_handler::PARSE_OVERSIZE;
         }
 
         command.address = (buf[command_index] << 8) | buf[command_index+1];
@@ -170,7 +227,8 @@ bool serial_frame_handler::buf2queue(uint8_t *buf,
          */
         if(command_index + command.payload_size + 3 > len)
         {
-            return false;
+            queue.commit(0);
+            return serial_frame_handler::PARSE_MALFORMED;
         }
 
         /*
@@ -186,23 +244,408 @@ bool serial_frame_handler::buf2queue(uint8_t *buf,
          * computed checksum.
          */
         if(buf[command_index++] != command.checksum())
+        {
+            queue.commit(0);
+            return serial_frame_handler::PARSE_CHECKSUM;
+        }
+    }
+
+    return serial_frame_handler::PARSE_OK;
+}
+
+/*
+ * Reads a base 128 varint, least significant group first.
+ *
+ * @param buf The buffer the varint is read from.
+ * @param index The index of the varint, advanced past it.
+ * @param end The index the varint must end before.
+ * @param value The value read.
+ *
+ * @return True if a varint of at most 3 bytes was read.
+ */
+static bool read_varint(const uint8_t *buf, size_t &index, size_t end,
+                        uint32_t &value)
+{
+    value = 0;
+
+    for(size_t shift = 0; shift < 21; shift += 7)
+    {
+        if(index >= end)
         {
             return false;
         }
 
+        uint8_t byte = buf[index++];
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+
+        if((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Writes a base 128 varint, least significant group first.
+ *
+ * @return The number of bytes written.
+ */
+static size_t write_varint(uint8_t *buf, uint32_t value)
+{
+    size_t len = 0;
+
+    while(value >= 0x80)
+    {
+        buf[len++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+
+    buf[len++] = static_cast<uint8_t>(value);
+    return len;
+}
+
+/*
+ * Returns the zig-zag encoded difference between two 15 bit addresses, so
+ * small steps in either direction encode into small varints.
+ */
+static uint32_t address_delta(uint16_t prev, uint16_t address)
+{
+    int32_t delta = (address - prev) & 0x7FFF;
+    if(delta >= 0x4000)
+    {
+        delta -= 0x8000;
+    }
+
+    return (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+}
+
+/*
+ * Parses the commands of a v2 frame into reserved slots of a queue. On
+ * failure the reservation is abandoned. The format of a v2 frame is:
+ * 1 byte: V2_MARKER or'd with the V2_FLAG_ flags
+ * 2 bytes: frame id and base id, only if V2_FLAG_DELTA is set
+ * varint: number of serial commands in frame
+ * n bytes: serial commands
+ * 2 bytes: CRC16 of complete frame.
+ * Each command is:
+ * 1 byte: payload size in the high nibble, read flag in bit 3 and the
+ * address step from the previous command in bits 0-2
+ * varint: zig-zag address delta, only if the address step is 0
+ * 0-8 bytes: payload
+ * 1 byte: checksum, only if V2_FLAG_CHECKSUM is set.
+ * Addresses are relative to the previous command in the frame, starting
+ * from 0. Delta encoded payloads are only sent by the slave, so a received
+ * command with the V2_DELTA_SIZE payload size is rejected.
+ *
+ * @param buf The buffer containing the serial frame.
+ * @param len The length of the frame, including the CRC.
+ * @param queue The queue that parsed commands are placed into.
+ * @param command_num The number of commands parsed into the reservation.
+ *
+ * @return PARSE_OK if parsing is successful, otherwise the reason it failed.
+ */
+static serial_frame_handler::parse_status parse_v2(const uint8_t *buf,
+                     size_t len,
+                     abstract_queue<serial_command> &queue,
+                     uint16_t &command_num)
+{
+    bool checksums = (buf[0] & serial_frame_handler::V2_FLAG_CHECKSUM) != 0;
+    size_t end = len - 2;
+    size_t command_index = 1;
+    uint32_t count;
+
+    if(buf[0] & serial_frame_handler::V2_FLAG_DELTA)
+    {
+        command_index += 2;
+    }
+
+    if(!read_varint(buf, command_index, end, count) || count > 0xFFFF)
+    {
+        return serial_frame_handler::PARSE_MALFORMED;
+    }
+
+    command_num = static_cast<uint16_t>(count);
+
+    /*
+     * Reserve space for every command in the frame up front so the frame is
+     * either enqueued completely or not at all.
+     */
+    if(!queue.reserve(command_num))
+    {
+        return serial_frame_handler::PARSE_QUEUE_FULL;
+    }
+
+    uint16_t address = 0;
+
+    for(uint16_t i = 0; i < command_num; i++)
+    {
+        if(command_index >= end)
+        {
+            queue.commit(0);
+            return serial_frame_handler::PARSE_MALFORMED;
+        }
+
+        serial_command &command = queue.reserved(i);
+        uint8_t header = buf[command_index++];
+        command.payload_size = header >> 4;
+        command.timestamp = 0;
+
+        if(command.payload_size > serial_command::MAX_COMMAND_LEN)
+        {
+            queue.commit(0);
+            return serial_frame_handler::PARSE_OVERSIZE;
+        }
+
         /*
-         * Add command to queue.
+         * Step the address by the small step in the header, or by the
+         * varint delta that follows it.
          */
-        if(!queue.push(command))
+        uint32_t delta = header & 0x07;
+        if(delta == 0)
         {
-            return false;
+            if(!read_varint(buf, command_index, end, delta) || delta > 0xFFFF)
+            {
+                queue.commit(0);
+                return serial_frame_handler::PARSE_MALFORMED;
+            }
+
+            delta = (delta >> 1) ^ (0 - (delta & 1));
+        }
+
+        address = (address + delta) & 0x7FFF;
+        command.address = address | ((header & 0x08) ? 0x8000 : 0);
+
+        if(command_index + command.payload_size + (checksums ? 1 : 0) > end)
+        {
+            queue.commit(0);
+            return serial_frame_handler::PARSE_MALFORMED;
+        }
+
+        for(size_t j = 0; j < command.payload_size; j++)
+        {
+            command.data[j] = buf[command_index++];
+        }
+
+        if(checksums && buf[command_index++] != command.checksum())
+        {
+            queue.commit(0);
+            return serial_frame_handler::PARSE_CHECKSUM;
+        }
+    }
+
+    /*
+     * Every byte before the CRC must belong to a command.
+     */
+    if(command_index != end)
+    {
+        queue.commit(0);
+        return serial_frame_handler::PARSE_MALFORMED;
+    }
+
+    return serial_frame_handler::PARSE_OK;
+}
+
+/*
+ * Truncates the payload size of a queued command to MAX_COMMAND_LEN. A
+ * command only holds that many payload bytes, and the serializers stage
+ * each command in a buffer sized for it.
+ *
+ * @param command The command.
+ */
+static void clamp_payload(serial_command &command)
+{
+    if(command.payload_size > serial_command::MAX_COMMAND_LEN)
+    {
+        command.payload_size = serial_command::MAX_COMMAND_LEN;
+    }
+}
+
+/*
+ * Serializes one command in the v2 format.
+ *
+ * @param command The command.
+ * @param prev The address of the previous command in the frame, without the
+ * read flag. Updated to the address of this command.
+ * @param checksums If the per-command checksum is included.
+ * @param delta If not null, the payload is delta encoded when that is
+ * shorter.
+ * @param record If the payload is recorded in delta as sent.
+ * @param piece The buffer the command is written to, at least
+ * V2_MAX_COMMAND_LEN bytes.
+ *
+ * @return The number of bytes written.
+ */
+static size_t write_v2_command(const serial_command &command,
+                               uint16_t &prev,
+                               bool checksums,
+                               telemetry_delta *delta,
+                               bool record,
+                               uint8_t *piece)
+{
+    uint16_t address = command.address & 0x7FFF;
+    uint16_t step = (address - prev) & 0x7FFF;
+    size_t piece_len = 1;
+
+    /*
+     * A delta encoding is only used if it is shorter than the payload, so
+     * the command never grows past V2_MAX_COMMAND_LEN.
+     */
+    uint8_t delta_buf[telemetry_delta::MAX_DELTA_LEN];
+    size_t delta_len = delta != nullptr ? delta->encode(command, delta_buf) : 0;
+
+    uint8_t header = static_cast<uint8_t>(command.payload_size << 4);
+    if(delta_len > 0)
+    {
+        header = serial_frame_handler::V2_DELTA_SIZE << 4;
+    }
+
+    if(command.is_read())
+    {
+        header |= 0x08;
+    }
+
+    if(step >= 1 && step <= 7)
+    {
+        header |= step;
+    }
+    else
+    {
+        piece_len += write_varint(piece + piece_len, address_delta(prev, address));
+    }
+
+    piece[0] = header;
+
+    if(delta_len > 0)
+    {
+        memcpy(piece + piece_len, delta_buf, delta_len);
+        piece_len += delta_len;
+    }
+    else
+    {
+        for(size_t j = 0; j < command.payload_size; j++)
+        {
+            piece[piece_len++] = command.data[j];
+        }
+    }
+
+    if(checksums)
+    {
+        piece[piece_len++] = command.checksum();
+    }
+
+    if(delta != nullptr && record)
+    {
+        delta->record(command);
+    }
+
+    prev = address;
+    return piece_len;
+}
+
+/*
+ * Returns the number of bytes one command takes in the v2 format.
+ */
+static size_t v2_command_len(const serial_command &command,
+                             uint16_t &prev,
+                             bool checksums,
+                             telemetry_delta *delta)
+{
+    uint8_t piece[serial_frame_handler::V2_MAX_COMMAND_LEN];
+    return write_v2_command(command, prev, checksums, delta, false, piece);
+}
+
+/*
+ * Parses a buffer containing a complete serial frame whose CRC16 has already
+ * been verified, for example with a crc::crc16_state updated while the frame
+ * was received, and copies every command to a queue. Both the v1 and the v2
+ * format are accepted.
+ *
+ * @param buf The buffer containing the serial frame.
+ * @param len The length of the buffer containing the serial frame.
+ * @param queue The queue that parsed commands are placed into.
+ * @param dispatcher If not null, commands with a registered handler are
+ * passed to it instead of being placed into the queue.
+ * @param replies The queue that replies to read requests answered by the
+ * dispatcher are placed into.
+ * @param link_handler If not null, the handler of every command addressed
+ * to the link control range, which never reaches the dispatcher.
+ * @param link_context The context passed to the link handler.
+ *
+ * @return PARSE_OK if parsing is successful, otherwise the reason it failed.
+ */
+serial_frame_handler::parse_status serial_frame_handler::commands2queue(uint8_t *buf,
+                                                                        size_t len,
+                                                                        abstract_queue<serial_command> &queue,
+                                                                        command_dispatcher *dispatcher,
+                                                                        abstract_queue<serial_command> *replies,
+                                                                        command_handler link_handler,
+                                                                        void *link_context)
+{
+    /*
+     * Immediately return if buffer is too short to hold a frame.
+     */
+    if(len < 4)
+    {
+        return PARSE_MALFORMED;
+    }
+
+    /*
+     * Parse every command into the queue's reservation. The format is told
+     * apart by the first byte, which is never above 3 for a v1 frame.
+     */
+    uint16_t command_num = 0;
+    parse_status status = is_v2(buf)
+                          ? parse_v2(buf, len, queue, command_num)
+                          : parse_v1(buf, len, queue, command_num);
+
+    if(status != PARSE_OK)
+    {
+        return status;
+    }
+
+    /*
+     * Now that the whole frame is known to be valid, run the handler of
+     * every command and keep only the unhandled ones, packed to the front of
+     * the reservation.
+     */
+    size_t queued = command_num;
+    if(dispatcher != nullptr || link_handler != nullptr)
+    {
+        queued = 0;
+        for(uint16_t i = 0; i < command_num; i++)
+        {
+            serial_command &command = queue.reserved(i);
+            bool handled;
+
+            if(is_link_address(command.address))
+            {
+                handled = link_handler != nullptr &&
+                          link_handler(command, link_context);
+            }
+            else
+            {
+                handled = dispatcher != nullptr &&
+                          dispatcher->dispatch(command, replies);
+            }
+
+            if(!handled)
+            {
+                if(queued != i)
+                {
+                    queue.reserved(queued) = command;
+                }
+
+                queued++;
+            }
         }
     }
 
     /*
-     * Return true if all parsing completed without error.
+     * Publish every remaining command in the frame at once.
      */
-    return true;
+    return queue.commit(queued) ? PARSE_OK : PARSE_QUEUE_FULL;
 }
 
 /*
@@ -223,30 +666,43 @@ size_t serial_frame_handler::queue2buf(abstract_queue<serial_command> &queue,
                                        uint8_t *buf, size_t max_len)
 {
     /*
-     * Initialize the number of commands to 0 and the starting buffer length
-     * to 2 since the first 2 bytes of the frame are for the number of commands.
+     * Count how many commands fit in the frame before serializing anything,
+     * since the count leads the frame and is covered by the CRC. The required
+     * amount of space is at least 16 bytes remaining in the buffer before
+     * each command. The max size of a command is 12 bytes plus 2 for the
+     * frame CRC plus 1 for the trailing 0.
      */
+    size_t available = queue.size();
     uint16_t num_commands = 0;
     size_t buf_len = 2;
 
+    while(num_commands < available && buf_len + 15 < max_len)
+    {
+        serial_command &command = queue.peek(num_commands);
+        clamp_payload(command);
+        buf_len += 4 + command.payload_size;
+        num_commands++;
+    }
+
     /*
-     * Keep looping until the queue is empty or there is not enough space 
-     * left in the buffer. The required amount of space is at least 14 bytes
-     * remaining in the buffer. The max size of a command is 12 bytes plus
-     * 2 for the frame CRC plus 1 for the trailing 0.
+     * Set the first two bytes of packet to the number of commands and start
+     * the running frame CRC.
      */
-    while(!queue.empty() && buf_len + 15 < max_len)
+    buf[0] = static_cast<uint8_t>(num_commands >> 8);
+    buf[1] = static_cast<uint8_t>(num_commands & 0xFF);
+    buf_len = 2;
+
+    crc::crc16_state crc;
+    crc.init();
+    crc.update(buf, buf_len);
+
+    /*
+     * Serialize each command and add it to the CRC while it is still hot.
+     */
+    for(uint16_t i = 0; i < num_commands; i++)
     {
-        /*
-         * Get next command from queue and increment the command counter.
-         */
-        serial_command command;
-        if(!queue.pop(command))
-        {
-            return false;
-        }
-        
-        num_commands++;
+        serial_command &command = queue.peek(i);
+        size_t command_start = buf_len;
 
         /*
          * Put payload size and address from command into buffer.
@@ -267,22 +723,309 @@ size_t serial_frame_handler::queue2buf(abstract_queue<serial_command> &queue,
          * Put checksum into buffer.
          */
         buf[buf_len++] = command.checksum();
+
+        crc.update(buf + command_start, buf_len - command_start);
     }
 
     /*
-     * Set the first two bytes of packet to the number of commands processed.
+     * Remove the serialized commands from the queue.
      */
-    buf[0] = static_cast<uint8_t>(num_commands >> 8);
-    buf[1] = static_cast<uint8_t>(num_commands & 0xFF);
+    if(!queue.consume(num_commands))
+    {
+        return 0;
+    }
 
     /*
      * Put the frame CRC to the end of the buffer and return the buffer length.
      */
-    uint16_t checksum = crc::crc16(buf, buf_len);
+    uint16_t checksum = crc.finalize();
     buf[buf_len++] = static_cast<uint8_t>(checksum >> 8);
     buf[buf_len++] = static_cast<uint8_t>(checksum & 0xFF);
 
     buf[buf_len++] = 0;
 
     return buf_len;
-}
\ No newline at end of file
+}
+
+/*
+ * Creates a COBS encoded frame with all of the commands in a queue in a
+ * single pass. Each command is serialized, added to the running CRC and
+ * COBS encoded into the output buffer before the next one is read, so no
+ * intermediate frame buffer is needed. The decoded frame is identical to
+ * the one built by queue2buf, including its trailing 0.
+ *
+ * @param queue The queue commands are taken from.
+ * @param encoded_buf The buffer that the encoded frame is put into.
+ * @param max_len The capacity of the encoded buffer.
+ *
+ * @return The length of the encoded frame, including the delimiter, or 0 if
+ * creation of frame unsuccessful.
+ */
+size_t serial_frame_handler::queue2cobs(abstract_queue<serial_command> &queue,
+                                        uint8_t *encoded_buf, size_t max_len)
+{
+    return queue2cobs(queue, encoded_buf, max_len, nullptr, 0);
+}
+
+/*
+ * Creates a COBS encoded frame like queue2cobs, prefixed with a header that
+ * is covered by the frame CRC, for example the sequence number of a
+ * full-duplex frame.
+ *
+ * @param queue The queue commands are taken from.
+ * @param encoded_buf The buffer that the encoded frame is put into.
+ * @param max_len The capacity of the encoded buffer.
+ * @param header The header placed in front of the command count.
+ * @param header_len The length of the header.
+ *
+ * @return The length of the encoded frame, including the delimiter, or 0 if
+ * creation of frame unsuccessful.
+ */
+size_t serial_frame_handler::queue2cobs(abstract_queue<serial_command> &queue,
+                                        uint8_t *encoded_buf, size_t max_len,
+                                        const uint8_t *header, size_t header_len)
+{
+    abstract_queue<serial_command> *queues[1] = { &queue };
+    return queue2cobs(queues, 1, encoded_buf, max_len, header, header_len);
+}
+
+/*
+ * Creates a COBS encoded frame like queue2cobs from the commands of several
+ * queues. Earlier queues are drained first, so a queue of urgent replies can
+ * be placed ahead of the transmit queue.
+ *
+ * @param queues The queues commands are taken from, in priority order.
+ * @param queue_count The number of queues. At most MAX_FRAME_QUEUES.
+ * @param encoded_buf The buffer that the encoded frame is put into.
+ * @param max_len The capacity of the encoded buffer.
+ * @param header The header placed in front of the command count.
+ * @param header_len The length of the header.
+ * @param format The wire format of the frame. v1 frames end with a trailing
+ * 0 after the CRC; v2 frames do not.
+ * @param delta If not null and the format allows deltas, the delta state
+ * payloads are encoded against. The frame becomes its current frame.
+ * @param queue_wait If not null, the histogram the time each timestamped
+ * command spent queued is recorded in.
+ * @param now_us The current high resolution time, in microseconds.
+ * @param framed If not null, set to the number of commands in the frame, or
+ * 0 if creation of frame unsuccessful.
+ *
+ * @return The length of the encoded frame, including the delimiter, or 0 if
+ * creation of frame unsuccessful.
+ */
+size_t serial_frame_handler::queue2cobs(abstract_queue<serial_command> *const *queues,
+                                        size_t queue_count,
+                                        uint8_t *encoded_buf, size_t max_len,
+                                        const uint8_t *header, size_t header_len,
+                                        const frame_format &format,
+                                        telemetry_delta *delta,
+                                        latency_histogram *queue_wait,
+                                        uint32_t now_us,
+                                        uint16_t *framed)
+{
+    if(framed != nullptr)
+    {
+        *framed = 0;
+    }
+
+    /*
+     * Budget the decoded frame so that its encoding, with one code byte for
+     * every 254 bytes plus the delimiter, always fits in the encoded buffer.
+     */
+    if(max_len < header_len + 0x20 || queue_count > MAX_FRAME_QUEUES)
+    {
+        return 0;
+    }
+
+    size_t decoded_max_len = max_len - max_len / 0xFE - 2 - header_len;
+    bool v2 = format.version == 2;
+
+    if(!v2 || !format.deltas)
+    {
+        delta = nullptr;
+    }
+
+    /*
+     * Count how many commands of each queue fit in the frame before
+     * serializing anything, using the same space rule as queue2buf. The
+     * counts are kept since producers may add commands in the meantime. A v2
+     * frame leaves room for a 3 byte count and the CRC after the largest
+     * command.
+     */
+    uint16_t queue_commands[MAX_FRAME_QUEUES];
+    uint16_t num_commands = 0;
+    size_t decoded_len = v2 ? 4 : 2;
+    if(delta != nullptr)
+    {
+        decoded_len += 2;
+    }
+
+    size_t reserve_len = v2 ? V2_MAX_COMMAND_LEN + 2 : 15;
+    uint16_t prev = 0;
+
+    for(size_t q = 0; q < queue_count; q++)
+    {
+        size_t available = queues[q]->size();
+        queue_commands[q] = 0;
+
+        while(queue_commands[q] < available &&
+              decoded_len + reserve_len < decoded_max_len)
+        {
+            serial_command &command = queues[q]->peek(queue_commands[q]);
+            clamp_payload(command);
+
+            if(v2)
+            {
+                decoded_len += v2_command_len(command, prev, format.checksums, delta);
+            }
+            else
+            {
+                decoded_len += 4 + command.payload_size;
+            }
+
+            queue_commands[q]++;
+        }
+
+        num_commands += queue_commands[q];
+    }
+
+    /*
+     * Emit the number of commands and start the running frame CRC. Each
+     * piece of the frame is staged in a buffer large enough for one command.
+     */
+    uint8_t piece[V2_MAX_COMMAND_LEN];
+    size_t piece_len = 0;
+
+    crc::crc16_state crc;
+    crc.init();
+
+    cobs::encoder encoder;
+    encoder.reset(encoded_buf, max_len);
+
+    crc.update(header, header_len);
+    encoder.put(header, header_len);
+
+    if(v2)
+    {
+        piece[piece_len++] = V2_MARKER | (format.checksums ? V2_FLAG_CHECKSUM : 0);
+
+        if(delta != nullptr)
+        {
+            delta->begin_frame();
+            piece[0] |= V2_FLAG_DELTA;
+            piece[piece_len++] = delta->frame_id();
+            piece[piece_len++] = delta->base_id();
+        }
+
+        piece_len += write_varint(piece + piece_len, num_commands);
+    }
+    else
+    {
+        piece[piece_len++] = static_cast<uint8_t>(num_commands >> 8);
+        piece[piece_len++] = static_cast<uint8_t>(num_commands & 0xFF);
+    }
+
+    crc.update(piece, piece_len);
+    encoder.put(piece, piece_len);
+    prev = 0;
+
+    for(size_t q = 0; q < queue_count; q++)
+    {
+        for(uint16_t i = 0; i < queue_commands[q]; i++)
+        {
+            serial_command &command = queues[q]->peek(i);
+            piece_len = 0;
+
+            /*
+             * Put payload size, address, payload and checksum into the piece.
+             */
+            if(v2)
+            {
+                piece_len = write_v2_command(command, prev, format.checksums,
+                                             delta, true, piece);
+            }
+            else
+            {
+                piece[piece_len++] = command.payload_size;
+                piece[piece_len++] = static_cast<uint8_t>(command.address >> 8);
+                piece[piece_len++] = static_cast<uint8_t>(command.address & 0xFF);
+
+                for(size_t j = 0; j < command.payload_size; j++)
+                {
+                    piece[piece_len++] = command.data[j];
+                }
+
+                piece[piece_len++] = command.checksum();
+            }
+
+            crc.update(piece, piece_len);
+            encoder.put(piece, piece_len);
+
+            if(queue_wait != nullptr && command.timestamp != 0)
+            {
+                queue_wait->record(now_us - command.timestamp);
+            }
+        }
+
+        /*
+         * Remove the serialized commands from the queue.
+         */
+        if(!queues[q]->consume(queue_commands[q]))
+        {
+            return 0;
+        }
+    }
+
+    /*
+     * Put the frame CRC, and for v1 the trailing 0, at the end of the frame.
+     */
+    uint16_t checksum = crc.finalize();
+    piece_len = 0;
+    piece[piece_len++] = static_cast<uint8_t>(checksum >> 8);
+    piece[piece_len++] = static_cast<uint8_t>(checksum & 0xFF);
+
+    if(!v2)
+    {
+        piece[piece_len++] = 0;
+    }
+
+    encoder.put(piece, piece_len);
+
+    size_t encoded_len = encoder.finish();
+    if(framed != nullptr && encoded_len > 0)
+    {
+        *framed = num_commands;
+    }
+
+    return encoded_len;
+}
+
+/*
+ * Returns the number of commands in a frame of either format.
+ *
+ * @param buf The buffer containing the serial frame.
+ * @param len The length of the frame, including the CRC.
+ *
+ * @return The number of commands, or 0 if the count cannot be read.
+ */
+uint16_t serial_frame_handler::command_count(const uint8_t *buf, size_t len)
+{
+    if(len < 4)
+    {
+        return 0;
+    }
+
+    if(!is_v2(buf))
+    {
+        return (buf[0] << 8) | buf[1];
+    }
+
+    size_t index = (buf[0] & V2_FLAG_DELTA) ? 3 : 1;
+    uint32_t count;
+    if(!read_varint(buf, index, len - 2, count) || count > 0xFFFF)
+    {
+        return 0;
+    }
+
+    return static_cast<uint16_t>(count);
+}
@@ -0,0 +1,189 @@
+/*
+ * Implementation of serial_manager class.
+ */
+
+#include "serial_manager.h"
+
+/*
+ * Returns true if timestamp a is before timestamp b. Handles the system
+ * timer wrapping around.
+ */
+static bool time_before(uint32_t a, uint32_t b)
+{
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+/*
+ * Constructor for serial manager with no ports.
+ */
+serial_manager::serial_manager() :
+    brain_ptr(nullptr),
+    port_count(0),
+    schedule_(ROUND_ROBIN),
+    next_port(0)
+{
+}
+
+/*
+ * Registers a serial port with the manager. This must be called before init.
+ *
+ * @param ser_port The serial port to service.
+ * @param port The smart port used for serial communication. The range of
+ * allowable values is 0 (Port 1) to 20 (Port 21).
+ * @param baudrate The baudrate the serial port should communicate at.
+ * @return True if the port was registered.
+ */
+bool serial_manager::add(serial_port &ser_port, int32_t port, int32_t baudrate)
+{
+    if(port_count == MAX_PORTS)
+    {
+        return false;
+    }
+
+    ser_port.configure(port, baudrate);
+    ports[port_count++] = &ser_port;
+    return true;
+}
+
+/*
+ * Starts the thread that services every registered port.
+ *
+ * @param brain The VEX Brain object.
+ * @param schedule The order in which ports that are due get polled.
+ */
+void serial_manager::init(vex::brain &brain, serial_schedule schedule)
+{
+    brain_ptr = &brain;
+    schedule_ = schedule;
+    terminated.set_value(false);
+
+    /*
+     * Create serial communication thread and detach it.
+     */
+    ser_thread = vex::task(task_entry, this);
+}
+
+/*
+ * This function signals the manager routine to end.
+ */
+void serial_manager::destroy()
+{
+    terminated.set_value(true);
+}
+
+/*
+ * Thread entry point that runs the manager routine of the serial manager
+ * passed as the argument.
+ *
+ * @param arg Pointer to the serial manager.
+ * @return Always 0.
+ */
+int serial_manager::task_entry(void *arg)
+{
+    static_cast<serial_manager*>(arg)->manager_routine();
+    return 0;
+}
+
+/*
+ * Polls every port that is due once, starting one port later than the
+ * previous pass.
+ *
+ * @param now The current system time, in milliseconds.
+ */
+void serial_manager::poll_round_robin(uint32_t now)
+{
+    size_t index = next_port;
+
+    for(size_t i = 0; i < port_count; i++)
+    {
+        if(!time_before(now, wake_times[index]))
+        {
+            wake_times[index] = ports[index]->poll();
+        }
+
+        index = index + 1 == port_count ? 0 : index + 1;
+    }
+
+    next_port = next_port + 1 == port_count ? 0 : next_port + 1;
+}
+
+/*
+ * Repeatedly polls the port with the earliest wake time while it is due,
+ * at most once per registered port so one busy port cannot starve the
+ * sleep below.
+ *
+ * @param now The current system time, in milliseconds.
+ */
+void serial_manager::poll_earliest_deadline(uint32_t now)
+{
+    for(size_t polls = 0; polls < port_count; polls++)
+    {
+        size_t earliest = 0;
+        for(size_t i = 1; i < port_count; i++)
+        {
+            if(time_before(wake_times[i], wake_times[earliest]))
+            {
+                earliest = i;
+            }
+        }
+
+        if(time_before(now, wake_times[earliest]))
+        {
+            break;
+        }
+
+        wake_times[earliest] = ports[earliest]->poll();
+    }
+}
+
+/*
+ * Function that runs in separate thread that handles serial I/O for every
+ * registered smart port.
+ */
+void serial_manager::manager_routine()
+{
+    uint32_t now = brain_ptr->Timer.system();
+
+    for(size_t i = 0; i < port_count; i++)
+    {
+        ports[i]->start(*brain_ptr);
+        wake_times[i] = now;
+    }
+
+    while(!terminated.get_value())
+    {
+        now = brain_ptr->Timer.system();
+
+        if(schedule_ == EARLIEST_DEADLINE)
+        {
+            poll_earliest_deadline(now);
+        }
+        else
+        {
+            poll_round_robin(now);
+        }
+
+        /*
+         * Pause until the earliest port expects work. If that is now, only
+         * yield so other tasks can run.
+         */
+        now = brain_ptr->Timer.system();
+        uint32_t wake_time = now + 1;
+        for(size_t i = 0; i < port_count; i++)
+        {
+            if(i == 0 || time_before(wake_times[i], wake_time))
+            {
+                wake_time = wake_times[i];
+            }
+        }
+
+        if(!time_before(now, wake_time))
+        {
+            vex::this_thread::yield();
+        }
+        else
+        {
+            vex::this_thread::sleep_until(wake_time);
+        }
+    }
+}
@@ -0,0 +1,1351 @@
+/*
+ * Implementation of serial_port class.
+ *
+ * @author John Sauer
+ * @date 10/14/2019
+ */
+
+#include "serial_port.h"
+
+/*
+ * The baud rates the link can be switched between, slowest first.
+ */
+static const int32_t BAUD_LADDER[] = { 115200, 230400, 256000, 460800, 921600 };
+
+/*
+ * The number of baud rates in BAUD_LADDER.
+ */
+static const size_t BAUD_LADDER_LEN = sizeof(BAUD_LADDER) / sizeof(BAUD_LADDER[0]);
+
+/*
+ * Returns true if timestamp a is before timestamp b. Handles the system
+ * timer wrapping around.
+ */
+static bool time_before(uint32_t a, uint32_t b)
+{
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+/*
+ * Constructor for a serial port using externally owned storage. The link
+ * starts in half-duplex mode.
+ *
+ * @param rx_buf The buffer received frames are decoded into.
+ * @param rx_buf_cap The capacity of the receive frame buffer.
+ * @param tx_buf The buffer transmitted frames are encoded into.
+ * @param tx_buf_cap The capacity of the transmit frame buffer.
+ * @param rx_queue The queue received commands are placed into.
+ * @param tx_queue The queue transmitted commands are taken from.
+ */
+serial_port::serial_port(uint8_t *rx_buf,
+                         size_t rx_buf_cap,
+                         uint8_t *tx_buf,
+                         size_t tx_buf_cap,
+                         abstract_queue<serial_command> &rx_queue,
+                         abstract_queue<serial_command> &tx_queue) :
+    rx_queue_(rx_queue),
+    tx_queue_(tx_queue),
+    dispatcher_(nullptr),
+    brain_ptr(nullptr),
+    mode_(HALF_DUPLEX),
+    window_(1),
+    port_(0),
+    baudrate_(0),
+    max_baudrate_(BAUD_LADDER[BAUD_LADDER_LEN - 1]),
+    rx_buf(rx_buf),
+    rx_buf_cap(rx_buf_cap),
+    tx_buf(tx_buf),
+    tx_buf_cap(tx_buf_cap)
+{
+}
+
+/*
+ * Sets the smart port and baud rate used by this port. This must be called
+ * before the serial task starts.
+ *
+ * @param port The smart port used for serial communication. The range of
+ * allowable values is 0 (Port 1) to 20 (Port 21).
+ * @param baudrate The baudrate the serial port should communicate at.
+ */
+void serial_port::configure(int32_t port, int32_t baudrate)
+{
+    port_ = port;
+    baudrate_ = baudrate;
+}
+
+/*
+ * Routes received commands with a registered handler to the dispatcher
+ * instead of the receive queue. The handlers run in the serial task as soon
+ * as the frame containing the command is verified. This must be called
+ * before the serial task starts.
+ *
+ * @param dispatcher The dispatcher, or null to queue every command.
+ */
+void serial_port::set_dispatcher(command_dispatcher *dispatcher)
+{
+    dispatcher_ = dispatcher;
+}
+
+/*
+ * Limits the baud rates the master may switch the link to. This must be
+ * called before the serial task starts.
+ *
+ * @param baudrate The highest allowed baud rate. Rates of the ladder above
+ * it are refused.
+ */
+void serial_port::set_max_baudrate(int32_t baudrate)
+{
+    max_baudrate_ = baudrate;
+}
+
+/*
+ * Selects half-duplex or full-duplex operation. This must be called before
+ * the serial task starts. In full-duplex mode up to window frames may be
+ * sent before the first of them is acknowledged.
+ *
+ * @param mode The duplex mode of the link.
+ * @param window The number of unacknowledged frames allowed in flight. The
+ * range of allowable values is 1 to MAX_WINDOW.
+ */
+void serial_port::set_mode(serial_mode mode, uint8_t window)
+{
+    mode_ = mode;
+
+    if(window == 0)
+    {
+        window = 1;
+    }
+    else if(window > MAX_WINDOW)
+    {
+        window = MAX_WINDOW;
+    }
+
+    window_ = window;
+}
+
+/*
+ * Returns the number of successfully received frames.
+ *
+ * @return The number of successfully received frames.
+ */
+size_t serial_port::rx_frames()
+{
+    return rx_frames_.get_value();
+}
+
+/*
+ * Returns the number of successfully transmitted frames.
+ *
+ * @return The number of successfully transmitted frames.
+ */
+size_t serial_port::tx_frames()
+{
+    return tx_frames_.get_value();
+}
+
+/*
+ * Returns the number of receive errors.
+ *
+ * @return The number of receive errors.
+ */
+size_t serial_port::rx_errors()
+{
+    return rx_errors_.get_value();
+}
+
+/*
+ * Returns the number of receive errors of one cause.
+ *
+ * @param cause The cause of the errors.
+ *
+ * @return The number of receive errors of the cause.
+ */
+size_t serial_port::rx_errors(rx_error_cause cause)
+{
+    return rx_error_counts_[cause].get_value();
+}
+
+/*
+ * Returns the number of transmit errors.
+ *
+ * @return The number of transmit errors.
+ */
+size_t serial_port::tx_errors()
+{
+    return tx_errors_.get_value();
+}
+
+/*
+ * Returns the number of transmit errors of one cause.
+ *
+ * @param cause The cause of the errors.
+ *
+ * @return The number of transmit errors of the cause.
+ */
+size_t serial_port::tx_errors(tx_error_cause cause)
+{
+    return tx_error_counts_[cause].get_value();
+}
+
+/*
+ * Returns the time between the end of the last received frame and its reply
+ * being handed to the smart port.
+ *
+ * @return The last turnaround time, in microseconds.
+ */
+size_t serial_port::turnaround_us()
+{
+    return turnaround_us_.get_value();
+}
+
+/*
+ * Returns the baud rate the smart port currently runs at.
+ *
+ * @return The current baud rate.
+ */
+int32_t serial_port::baudrate()
+{
+    return baud_.get_value();
+}
+
+/*
+ * Returns the latency histogram of a pipeline stage.
+ *
+ * @param stage The stage.
+ *
+ * @return The histogram of the stage.
+ */
+latency_histogram &serial_port::latency(latency_stage stage)
+{
+    return latency_[stage];
+}
+
+/*
+ * Queues a command for transmission, stamped with the time it was queued so
+ * its wait is measured.
+ *
+ * @param command The command to send.
+ *
+ * @return True if the command was queued.
+ */
+bool serial_port::send(const serial_command &command)
+{
+    /*
+     * The brain timer reads the same clock, but the brain pointer is only
+     * set once the serial task starts.
+     */
+    serial_command stamped(command);
+    stamped.timestamp = static_cast<uint32_t>(vexSystemHighResTimeGet());
+
+    if(stamped.timestamp == 0)
+    {
+        stamped.timestamp = 1;
+    }
+
+    return tx_queue_.push(stamped);
+}
+
+/*
+ * Returns the serial command receive queue.
+ *
+ * @return The serial command receive queue.
+ */
+abstract_queue<serial_command> &serial_port::rx_queue()
+{
+    return rx_queue_;
+}
+
+/*
+ * Returns the serial command transmit queue.
+ *
+ * @return The serial command transmit queue.
+ */
+abstract_queue<serial_command> &serial_port::tx_queue()
+{
+    return tx_queue_;
+}
+
+/*
+ * Serializes the transmit queue into a COBS encoded frame and sends it. In
+ * full-duplex mode the frame is prefixed with its sequence number and the
+ * acknowledgement of the last frame received in order.
+ */
+void serial_port::transmit_frame()
+{
+    /*
+     * A full-duplex frame without commands only carries an acknowledgement
+     * and does not take a sequence number. While the in-flight window is
+     * full only such pure acknowledgements are sent, and the queues are
+     * left alone.
+     */
+    uint8_t in_flight = tx_seq - tx_acked;
+    bool window_open = mode_ == HALF_DUPLEX || in_flight < window_;
+    size_t queue_count = window_open ? 2 : 0;
+    uint16_t framed = 0;
+    uint8_t header[FULL_DUPLEX_HEADER_LEN] = { tx_seq, rx_expected };
+    size_t header_len = mode_ == FULL_DUPLEX ? FULL_DUPLEX_HEADER_LEN : 0;
+
+    /*
+     * Serialize, checksum and COBS encode the replies to read requests and
+     * then the serial commands from the transmit queue straight into the
+     * transmit buffer.
+     */
+    abstract_queue<serial_command> *queues[2] = { &reply_queue_, &tx_queue_ };
+    size_t tx_len = 
+      serial_frame_handler::queue2cobs(queues,
+                                       queue_count,
+                                       tx_buf,
+                                       tx_buf_cap,
+                                       header,
+                                       header_len,
+                                       tx_format_,
+                                       &delta_,
+                                       &latency_[LATENCY_QUEUE_WAIT],
+                                       time_us(),
+                                       &framed);
+
+    if(tx_len > 0)
+    {
+        /*
+         * Send encoded serial frame.
+         */
+        if(vexDeviceGenericSerialTransmit(smart_port, 
+                                          tx_buf,
+                                          tx_len) 
+           == static_cast<int32_t>(tx_len))
+        {
+            tx_frames_.fetch_add(1);
+
+            /*
+             * Record when the frame will have left the wire.
+             */
+            uint32_t now = brain_ptr->Timer.system();
+            tx_clear_time = now + (tx_len + bytes_per_ms - 1) / bytes_per_ms;
+
+            /*
+             * A baud rate switch announced in this frame happens once the
+             * frame has been sent.
+             */
+            if(pending_baud != 0 && !baud_switch_armed)
+            {
+                baud_switch_armed = true;
+                baud_switch_time = tx_clear_time;
+            }
+
+            /*
+             * In half-duplex mode record the time from the end of the
+             * received frame to the reply being handed to the smart port.
+             */
+            if(mode_ == HALF_DUPLEX)
+            {
+                uint32_t turnaround = time_us() - rx_complete_us;
+                turnaround_us_.set_value(turnaround);
+                latency_[LATENCY_TURNAROUND].record(turnaround);
+            }
+
+            /*
+             * Track the frame as in flight until the peer acknowledges it.
+             */
+            else
+            {
+                ack_owed = false;
+
+                /*
+                 * The queues may have changed since the caller looked, so
+                 * only the commands actually framed decide if the frame
+                 * took the sequence number.
+                 */
+                if(framed > 0)
+                {
+                    if(tx_seq == tx_acked)
+                    {
+                        ack_deadline = now + ACK_TIMEOUT;
+                    }
+
+                    tx_seq++;
+                }
+            }
+        }
+        /*
+         * If transmit fails by not sending the number of bytes
+         * expected, then report an error.
+         */
+        else
+        {
+            count_tx_error(TX_SHORT_WRITE);
+        }
+    }
+    /*
+     * If creating the encoded frame fails, then report an error.
+     */
+    else
+    {
+        count_tx_error(TX_FRAME);
+    }
+}
+
+/*
+ * Returns if a full-duplex frame may be sent now. The previous frame must
+ * have left the wire, and either an acknowledgement is owed or there are
+ * commands to send and room in the in-flight window.
+ *
+ * @param now The current system time, in milliseconds.
+ *
+ * @return True if a frame should be transmitted.
+ */
+bool serial_port::can_transmit(uint32_t now)
+{
+    if(static_cast<int32_t>(tx_clear_time - now) > 0)
+    {
+        return false;
+    }
+
+    uint8_t in_flight = tx_seq - tx_acked;
+    bool has_commands = !reply_queue_.empty() || !tx_queue_.empty();
+    return ack_owed || (has_commands && in_flight < window_);
+}
+
+/*
+ * Handles the acknowledgement field of a received full-duplex frame. The
+ * field is the sequence number of the next frame the peer expects, so it
+ * acknowledges every frame before it.
+ *
+ * @param ack The acknowledgement field of the received frame.
+ */
+void serial_port::receive_ack(uint8_t ack)
+{
+    uint8_t acked = ack - tx_acked;
+    uint8_t in_flight = tx_seq - tx_acked;
+
+    if(acked != 0 && acked <= in_flight)
+    {
+        tx_acked = ack;
+        ack_deadline = brain_ptr->Timer.system() + ACK_TIMEOUT;
+    }
+}
+
+/*
+ * Handles the sequence number of a received full-duplex frame. Frames
+ * without commands are pure acknowledgements and are not sequenced. A gap
+ * in the sequence means frames were lost and is counted as a receive error,
+ * unless it is no wider than the number of frames already counted as
+ * receive errors since the last sequenced frame. Those frames were lost to
+ * a decode, CRC or parse failure and are not counted twice.
+ *
+ * @param seq The sequence number of the received frame.
+ * @param command_num The number of commands in the received frame.
+ */
+void serial_port::receive_sequence(uint8_t seq, uint16_t command_num)
+{
+    if(command_num == 0)
+    {
+        return;
+    }
+
+    uint8_t gap = seq - rx_expected;
+    if(gap > rx_lost)
+    {
+        count_rx_error(RX_SEQUENCE);
+    }
+
+    rx_expected = seq + 1;
+    rx_lost = 0;
+    ack_owed = true;
+}
+
+/*
+ * Gives up on in-flight frames that have not been acknowledged within
+ * ACK_TIMEOUT. Frames are not retransmitted, so their commands are lost and
+ * a transmit error is reported.
+ *
+ * @param now The current system time, in milliseconds.
+ */
+void serial_port::expire_in_flight(uint32_t now)
+{
+    if(tx_seq != tx_acked && static_cast<int32_t>(now - ack_deadline) > 0)
+    {
+        count_tx_error(TX_ACK_TIMEOUT);
+        tx_acked = tx_seq;
+    }
+}
+
+/*
+ * Handles commands addressed to the link control range. Runs in the serial
+ * task while the received frame is parsed.
+ *
+ * A write to LINK_CAPS carries the highest wire format version the master
+ * accepts and the v2 flags it wants. From then on frames are transmitted in
+ * the highest version both sides support, and the chosen version and flags
+ * are answered at LINK_CAPS in the next frame. A read of LINK_CAPS answers
+ * the current format. Masters that never write LINK_CAPS keep receiving v1
+ * frames. Received frames of either version are always accepted.
+ *
+ * Delta encoded payloads are only offered in half-duplex mode, where a
+ * single frame is awaiting acknowledgement at LINK_DELTA_ACK at any time.
+ *
+ * @param command The link control command.
+ * @param context Pointer to the serial port.
+ * @return True if the command was handled.
+ */
+bool serial_port::link_command(serial_command &command, void *context)
+{
+    serial_port *port = static_cast<serial_port*>(context);
+    uint16_t address = command.address & 0x7FFF;
+
+    /*
+     * The statistics range is read-only, so writes to it are dropped.
+     */
+    if(address >= serial_frame_handler::LINK_STATS_BASE)
+    {
+        uint32_t value;
+        if(command.is_read() && port->link_stat(address, value))
+        {
+            serial_command reply;
+            reply.address = command.address;
+            reply.payload_size = 4;
+            reply.data[0] = static_cast<uint8_t>(value >> 24);
+            reply.data[1] = static_cast<uint8_t>(value >> 16);
+            reply.data[2] = static_cast<uint8_t>(value >> 8);
+            reply.data[3] = static_cast<uint8_t>(value);
+            port->reply_queue_.push(reply);
+        }
+
+        return true;
+    }
+
+    if(address == serial_frame_handler::LINK_DELTA_ACK)
+    {
+        if(command.is_read() || command.payload_size < 1)
+        {
+            return false;
+        }
+
+        port->delta_.ack(command.data[0]);
+        return true;
+    }
+
+    if(address == serial_frame_handler::LINK_BAUD)
+    {
+        int32_t baudrate = port->current_baud;
+
+        if(!command.is_read())
+        {
+            if(command.payload_size < 4)
+            {
+                return false;
+            }
+
+            baudrate = static_cast<int32_t>((command.data[0] << 24) |
+                                            (command.data[1] << 16) |
+                                            (command.data[2] << 8) |
+                                            command.data[3]);
+
+            /*
+             * Only rates of the ladder up to the limit are accepted.
+             * Otherwise the current rate is answered and kept.
+             */
+            bool valid = false;
+            for(size_t i = 0; i < BAUD_LADDER_LEN; i++)
+            {
+                valid = valid || BAUD_LADDER[i] == baudrate;
+            }
+
+            if(!valid || baudrate > port->max_baudrate_)
+            {
+                baudrate = port->current_baud;
+            }
+        }
+
+        if(baudrate != port->current_baud)
+        {
+            port->request_baud(baudrate);
+        }
+        else
+        {
+            serial_command reply;
+            reply.address = command.address;
+            reply.payload_size = 4;
+            reply.data[0] = static_cast<uint8_t>(baudrate >> 24);
+            reply.data[1] = static_cast<uint8_t>(baudrate >> 16);
+            reply.data[2] = static_cast<uint8_t>(baudrate >> 8);
+            reply.data[3] = static_cast<uint8_t>(baudrate);
+            port->reply_queue_.push(reply);
+        }
+
+        return true;
+    }
+
+    if(address != serial_frame_handler::LINK_CAPS)
+    {
+        return false;
+    }
+
+    serial_frame_handler::frame_format &format = port->tx_format_;
+
+    if(!command.is_read())
+    {
+        if(command.payload_size < 1)
+        {
+            return false;
+        }
+
+        uint8_t flags = command.payload_size >= 2 ? command.data[1] : 0;
+        format.version = command.data[0] >= 2 ? 2 : 1;
+        format.checksums = format.version == 1 ||
+          (flags & serial_frame_handler::V2_FLAG_CHECKSUM) != 0;
+        format.deltas = format.version == 2 &&
+          port->mode_ == HALF_DUPLEX &&
+          (flags & serial_frame_handler::V2_FLAG_DELTA) != 0;
+        port->delta_.reset();
+    }
+
+    serial_command reply;
+    reply.address = command.address;
+    reply.payload_size = 2;
+    reply.data[0] = format.version;
+    reply.data[1] = 0;
+
+    if(format.checksums)
+    {
+        reply.data[1] |= serial_frame_handler::V2_FLAG_CHECKSUM;
+    }
+
+    if(format.deltas)
+    {
+        reply.data[1] |= serial_frame_handler::V2_FLAG_DELTA;
+    }
+
+    port->reply_queue_.push(reply);
+    return true;
+}
+
+/*
+ * Looks up a value of the link statistics range.
+ *
+ * @param address The address, without the read flag.
+ * @param value Set to the value at the address.
+ *
+ * @return True if a statistic lives at the address.
+ */
+bool serial_port::link_stat(uint16_t address, uint32_t &value)
+{
+    using namespace serial_frame_handler;
+
+    if(address >= LINK_STAT_LATENCY_BASE)
+    {
+        size_t stage = (address - LINK_STAT_LATENCY_BASE) / 4;
+        if(stage >= LATENCY_STAGES)
+        {
+            return false;
+        }
+
+        latency_histogram &histogram = latency_[stage];
+        switch((address - LINK_STAT_LATENCY_BASE) % 4)
+        {
+            case 0:
+                value = histogram.count();
+                break;
+            case 1:
+                value = histogram.percentile(500);
+                break;
+            case 2:
+                value = histogram.percentile(990);
+                break;
+            default:
+                value = histogram.max();
+                break;
+        }
+
+        return true;
+    }
+
+    if(address >= LINK_STAT_TX_ERROR_BASE)
+    {
+        if(address - LINK_STAT_TX_ERROR_BASE >= TX_ERROR_CAUSES)
+        {
+            return false;
+        }
+
+        value = tx_error_counts_[address - LINK_STAT_TX_ERROR_BASE].get_value();
+        return true;
+    }
+
+    if(address >= LINK_STAT_RX_ERROR_BASE)
+    {
+        if(address - LINK_STAT_RX_ERROR_BASE >= RX_ERROR_CAUSES)
+        {
+            return false;
+        }
+
+        value = rx_error_counts_[address - LINK_STAT_RX_ERROR_BASE].get_value();
+        return true;
+    }
+
+    switch(address)
+    {
+        case LINK_STAT_RX_FRAMES:
+            value = rx_frames_.get_value();
+            return true;
+        case LINK_STAT_TX_FRAMES:
+            value = tx_frames_.get_value();
+            return true;
+        case LINK_STAT_RX_ERRORS:
+            value = rx_errors_.get_value();
+            return true;
+        case LINK_STAT_TX_ERRORS:
+            value = tx_errors_.get_value();
+            return true;
+        case LINK_STAT_TURNAROUND:
+            value = turnaround_us_.get_value();
+            return true;
+        case LINK_STAT_BAUD:
+            value = static_cast<uint32_t>(current_baud);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Counts a receive error in the total and under its cause. Every cause but
+ * a sequence gap also stands for one lost frame.
+ *
+ * @param cause The cause of the error.
+ */
+void serial_port::count_rx_error(rx_error_cause cause)
+{
+    rx_errors_.fetch_add(1);
+    rx_error_counts_[cause].fetch_add(1);
+
+    if(cause != RX_SEQUENCE && rx_lost != UINT8_MAX)
+    {
+        rx_lost++;
+    }
+}
+
+/*
+ * Counts a transmit error in the total and under its cause.
+ *
+ * @param cause The cause of the error.
+ */
+void serial_port::count_tx_error(tx_error_cause cause)
+{
+    tx_errors_.fetch_add(1);
+    tx_error_counts_[cause].fetch_add(1);
+}
+
+/*
+ * Announces a baud rate switch at LINK_BAUD in the next frame. The switch
+ * happens once that frame has left the wire.
+ *
+ * @param baudrate The baud rate to switch to.
+ */
+void serial_port::request_baud(int32_t baudrate)
+{
+    serial_command announce;
+    announce.address = serial_frame_handler::LINK_BAUD;
+    announce.payload_size = 4;
+    announce.data[0] = static_cast<uint8_t>(baudrate >> 24);
+    announce.data[1] = static_cast<uint8_t>(baudrate >> 16);
+    announce.data[2] = static_cast<uint8_t>(baudrate >> 8);
+    announce.data[3] = static_cast<uint8_t>(baudrate);
+
+    if(reply_queue_.push(announce))
+    {
+        pending_baud = baudrate;
+        baud_switch_armed = false;
+    }
+}
+
+/*
+ * Switches the smart port to a baud rate. Bytes received at the old rate
+ * are discarded and the error rate window starts over. A rate that has not
+ * carried a valid frame yet is given up after BAUD_TRIAL_TIME.
+ *
+ * @param baudrate The new baud rate.
+ * @param now The current system time, in milliseconds.
+ */
+void serial_port::set_baud(int32_t baudrate, uint32_t now)
+{
+    vexDeviceGenericSerialBaudrate(smart_port, baudrate);
+    vexDeviceGenericSerialFlush(smart_port);
+
+    current_baud = baudrate;
+    baud_.set_value(baudrate);
+    pending_baud = 0;
+    baud_switch_armed = false;
+    baud_trial_deadline = now + BAUD_TRIAL_TIME;
+
+    bytes_per_ms = static_cast<uint32_t>(baudrate) / 10000;
+    if(bytes_per_ms == 0)
+    {
+        bytes_per_ms = 1;
+    }
+
+    rx_chunk_pos = 0;
+    rx_chunk_len = 0;
+    ser_state = START_RECEIVE;
+    window_frames = rx_frames_.get_value();
+    window_errors = line_errors();
+}
+
+/*
+ * Counts the receive errors caused by line noise: bytes corrupted or lost
+ * on the wire. Errors of the robot program or the peer, such as a full
+ * receive queue or a sequence gap, do not improve at a lower baud rate.
+ *
+ * @return The number of line noise errors since the port started.
+ */
+uint32_t serial_port::line_errors()
+{
+    return rx_error_counts_[RX_CRC].get_value() +
+           rx_error_counts_[RX_DECODE].get_value() +
+           rx_error_counts_[RX_OVERFLOW].get_value();
+}
+
+/*
+ * Steps the baud rate down one rung of the ladder when too many of the
+ * frames received in the last window were lost to line noise. Called after
+ * every valid frame, since that is when the announcement can reach the
+ * master.
+ */
+void serial_port::check_link_quality()
+{
+    uint32_t frames = rx_frames_.get_value() - window_frames;
+    uint32_t errors = line_errors() - window_errors;
+
+    if(frames + errors < QUALITY_WINDOW)
+    {
+        return;
+    }
+
+    window_frames += frames;
+    window_errors += errors;
+
+    if(errors * MAX_ERROR_RATIO <= frames + errors || pending_baud != 0)
+    {
+        return;
+    }
+
+    for(size_t i = BAUD_LADDER_LEN; i-- > 0;)
+    {
+        if(BAUD_LADDER[i] < current_baud)
+        {
+            request_baud(BAUD_LADDER[i]);
+            return;
+        }
+    }
+}
+
+/*
+ * Performs pending baud rate switches, gives up a new rate that never
+ * carried a valid frame and returns to the configured rate when the link is
+ * lost. The master applies the same timeouts, so both ends meet again.
+ *
+ * @param now The current system time, in milliseconds.
+ */
+void serial_port::check_link_loss(uint32_t now)
+{
+    if(baud_switch_armed && !time_before(now, baud_switch_time))
+    {
+        set_baud(pending_baud, now);
+    }
+    else if(current_baud != confirmed_baud &&
+            !time_before(now, baud_trial_deadline))
+    {
+        set_baud(confirmed_baud, now);
+    }
+    else if(current_baud != baudrate_ &&
+            !time_before(now, last_rx_time + LINK_LOSS_TIME))
+    {
+        confirmed_baud = baudrate_;
+        set_baud(baudrate_, now);
+        last_rx_time = now;
+    }
+}
+
+/*
+ * Returns the high resolution system time, truncated to 32 bits.
+ *
+ * @return The current time, in microseconds.
+ */
+uint32_t serial_port::time_us()
+{
+    return static_cast<uint32_t>(brain_ptr->Timer.systemHighResolution());
+}
+
+/*
+ * Makes sure unread received bytes are buffered in rx_chunk. If the
+ * previous chunk is used up, everything the smart port has received so far
+ * is read into rx_chunk with a single call, up to RX_CHUNK_CAP bytes.
+ *
+ * @return True if rx_chunk holds unread bytes.
+ */
+bool serial_port::fill_rx_chunk()
+{
+    if(rx_chunk_pos < rx_chunk_len)
+    {
+        return true;
+    }
+
+    rx_chunk_pos = 0;
+    rx_chunk_len = 0;
+
+    int32_t available = vexDeviceGenericSerialReceiveAvail(smart_port);
+    if(available <= 0)
+    {
+        return false;
+    }
+
+    if(available > static_cast<int32_t>(RX_CHUNK_CAP))
+    {
+        available = RX_CHUNK_CAP;
+    }
+
+    int32_t read_len = vexDeviceGenericSerialReceive(smart_port,
+                                                     rx_chunk,
+                                                     available);
+    if(read_len <= 0)
+    {
+        return false;
+    }
+
+    rx_chunk_len = static_cast<size_t>(read_len);
+    return true;
+}
+
+/*
+ * Works out when the serial routine should run next from the state machine,
+ * the baud rate and how much of the current frame is still expected.
+ *
+ * - A completed frame is answered immediately.
+ * - While a reply is still being clocked out, no answer can arrive yet.
+ * - While receiving, sleep for roughly the time the rest of the frame needs
+ *   to arrive, or spin if it is due within a millisecond and bytes are still
+ *   flowing. Never sleep past the receive timeout or so long that more than
+ *   RX_CHUNK_CAP bytes could pile up.
+ * - While idle, back off exponentially up to MAX_IDLE_TIME, but never so
+ *   long that more than RX_CHUNK_CAP bytes could pile up.
+ *
+ * @param now The current system time, in milliseconds.
+ *
+ * @return The system time to wake at, in milliseconds.
+ */
+uint32_t serial_port::next_wake_time(uint32_t now)
+{
+    if(mode_ == FULL_DUPLEX && can_transmit(now))
+    {
+        return now;
+    }
+
+    switch(ser_state)
+    {
+        case TRANSMITTING:
+        {
+            return now;
+        }
+        case RECEIVING:
+        {
+            /*
+             * Bytes that are already buffered are decoded right away.
+             */
+            if(rx_chunk_pos < rx_chunk_len)
+            {
+                return now;
+            }
+
+            /*
+             * Once the command count is decoded the smallest possible frame
+             * length is known: count, 4 bytes per command and the CRC.
+             */
+            size_t decoded = rx_decoder.size();
+            size_t expected = decoded + 1;
+            size_t header_len = mode_ == FULL_DUPLEX ? FULL_DUPLEX_HEADER_LEN : 0;
+            if(decoded >= header_len + 2 &&
+               !serial_frame_handler::is_v2(rx_buf + header_len))
+            {
+                expected = header_len + 4 + 4 * static_cast<size_t>(
+                  (rx_buf[header_len] << 8) | rx_buf[header_len + 1]);
+            }
+
+            size_t remaining = expected > decoded ? expected - decoded : 1;
+            uint32_t wait = static_cast<uint32_t>(remaining / bytes_per_ms);
+
+            /*
+             * Spin only while the frame is still arriving, so a stalled
+             * sender cannot keep the task busy until the timeout.
+             */
+            bool progressing = decoded != rx_progress;
+            rx_progress = decoded;
+
+            if(wait == 0)
+            {
+                return progressing ? now : now + ITER_TIME;
+            }
+
+            /*
+             * Wake in time to drain the smart port before more than
+             * RX_CHUNK_CAP bytes pile up.
+             */
+            if(wait > RX_CHUNK_CAP / bytes_per_ms)
+            {
+                wait = RX_CHUNK_CAP / bytes_per_ms;
+            }
+
+            if(static_cast<int32_t>(rx_timeout + 1 - (now + wait)) < 0)
+            {
+                return rx_timeout + 1;
+            }
+
+            return now + wait;
+        }
+        case START_RECEIVE:
+        {
+            if(mode_ == HALF_DUPLEX &&
+               static_cast<int32_t>(tx_clear_time - now) > 0)
+            {
+                idle_time = ITER_TIME;
+                return tx_clear_time;
+            }
+
+            uint32_t wait = idle_time;
+            uint32_t max_idle_time = RX_CHUNK_CAP / bytes_per_ms;
+            if(max_idle_time > MAX_IDLE_TIME)
+            {
+                max_idle_time = MAX_IDLE_TIME;
+            }
+
+            idle_time *= 2;
+            if(idle_time > max_idle_time)
+            {
+                idle_time = max_idle_time > ITER_TIME ? max_idle_time : ITER_TIME;
+            }
+
+            return now + wait;
+        }
+    }
+
+    return now + ITER_TIME;
+}
+
+/*
+ * Resets the state machine and counters and configures the smart port for
+ * serial communication. Runs in the serial task before the first poll.
+ *
+ * @param brain The VEX Brain object.
+ */
+void serial_port::start(vex::brain &brain)
+{
+    brain_ptr = &brain;
+
+    /*
+     * Initialize counters and state machine.
+     */
+    rx_frames_.set_value(0);
+    tx_frames_.set_value(0);
+    rx_errors_.set_value(0);
+    tx_errors_.set_value(0);
+    for(size_t i = 0; i < RX_ERROR_CAUSES; i++)
+    {
+        rx_error_counts_[i].set_value(0);
+    }
+    for(size_t i = 0; i < TX_ERROR_CAUSES; i++)
+    {
+        tx_error_counts_[i].set_value(0);
+    }
+    ser_state = START_RECEIVE;
+    reply_queue_.clear();
+    tx_format_ = serial_frame_handler::FORMAT_V1;
+    delta_.reset();
+    rx_chunk_pos = 0;
+    rx_chunk_len = 0;
+    turnaround_us_.set_value(0);
+    for(size_t i = 0; i < LATENCY_STAGES; i++)
+    {
+        latency_[i].reset();
+    }
+    idle_time = ITER_TIME;
+    tx_clear_time = brain_ptr->Timer.system();
+    rx_progress = 0;
+    tx_seq = 0;
+    tx_acked = 0;
+    rx_expected = 0;
+    rx_lost = 0;
+    ack_owed = false;
+    ack_deadline = tx_clear_time;
+    confirmed_baud = baudrate_;
+    last_rx_time = tx_clear_time;
+
+    /*
+     * Configure smart port.
+     */
+    smart_port = vexDeviceGetByIndex(port_);
+    vexDeviceGenericSerialEnable(smart_port, 0);
+    set_baud(baudrate_, tx_clear_time);
+}
+
+/*
+ * Runs one step of the serial I/O state machine. Runs in the serial task.
+ *
+ * @return The system time, in milliseconds, at which the port should be
+ * polled again. If it is not in the future, the port has more work now.
+ */
+uint32_t serial_port::poll()
+{
+    /*
+     * Run serial communication state machine.
+     */
+    switch(ser_state)
+    {
+        case TRANSMITTING:
+        {
+            transmit_frame();
+
+            /*
+             * Always reset after this state since this set of operations
+             * should complete in one iteration.
+             */
+            ser_state = START_RECEIVE;
+            break;
+        }
+        case START_RECEIVE:
+        {
+            bool frame_started = false;
+
+            while(fill_rx_chunk())
+            {
+
+                /*
+                 * Skip all leading zeroes. The first nonzero character
+                 * starts a new frame, which is decoded into rx_buf as
+                 * it arrives.
+                 */
+                while(rx_chunk_pos < rx_chunk_len && rx_chunk[rx_chunk_pos] == 0)
+                {
+                    rx_chunk_pos++;
+                }
+
+                if(rx_chunk_pos < rx_chunk_len)
+                {
+                    idle_time = ITER_TIME;
+                    rx_progress = 0;
+                    rx_decoder.reset(rx_buf, rx_buf_cap);
+                    rx_crc.init();
+                    rx_crc_len = 0;
+                    rx_timeout = brain_ptr->Timer.system() + TIMEOUT;
+                    rx_start_us = time_us();
+                    rx_decode_us = 0;
+                    ser_state = RECEIVING;
+                    frame_started = true;
+                    break;
+                }
+            }
+
+            if(!frame_started)
+            {
+                break;
+            }
+
+            /*
+             * Decode the rest of the chunk right away.
+             */
+        }
+
+        /* FALLTHROUGH */
+        case RECEIVING:
+        {
+            /*
+             * Report error and reset if current time exceeds timeout.
+             */
+            if(brain_ptr->Timer.system() > rx_timeout)
+            {
+                count_rx_error(RX_TIMEOUT);
+                ser_state = START_RECEIVE;
+                break;
+            }
+
+            while(fill_rx_chunk())
+            {
+                /*
+                 * Decode the buffered bytes up to the next delimiter.
+                 */
+                size_t consumed;
+                uint32_t decode_start_us = time_us();
+                cobs::decode_status status =
+                  rx_decoder.feed(rx_chunk + rx_chunk_pos,
+                                  rx_chunk_len - rx_chunk_pos,
+                                  consumed);
+                rx_chunk_pos += consumed;
+                uint32_t delimiter_us = time_us();
+                rx_decode_us += delimiter_us - decode_start_us;
+
+                /*
+                 * Keep reading while the frame is incomplete.
+                 */
+                if(status == cobs::DECODE_PENDING)
+                {
+                    continue;
+                }
+
+                /*
+                 * Report error and reset if the frame is malformed or
+                 * grows out of bounds.
+                 */
+                if(status != cobs::DECODE_COMPLETE || rx_decoder.size() == 0)
+                {
+                    count_rx_error(status == cobs::DECODE_OVERFLOW ? RX_OVERFLOW :
+                                   status == cobs::DECODE_ERROR ? RX_DECODE :
+                                   RX_MALFORMED);
+                    ser_state = START_RECEIVE;
+                    break;
+                }
+
+                latency_[LATENCY_RX_FRAME].record(delimiter_us - rx_start_us);
+
+                /*
+                 * The delimiter arrived and rx_buf already holds the
+                 * decoded frame. Finish the running CRC over the last
+                 * decoded bytes. A frame followed by its own CRC leaves
+                 * a CRC of 0.
+                 */
+                rx_crc.update(rx_buf + rx_crc_len,
+                              rx_decoder.size() - rx_crc_len);
+                rx_crc_len = rx_decoder.size();
+
+                if(rx_crc.finalize() != 0)
+                {
+                    /*
+                     * The lost frame may have held a delta acknowledgement,
+                     * so start the delta references over.
+                     */
+                    count_rx_error(RX_CRC);
+                    delta_.reset();
+                    ser_state = START_RECEIVE;
+                    break;
+                }
+
+                /*
+                 * In full-duplex mode the frame starts with its sequence
+                 * number and the peer's acknowledgement.
+                 */
+                size_t header_len = 0;
+                if(mode_ == FULL_DUPLEX)
+                {
+                    header_len = FULL_DUPLEX_HEADER_LEN;
+
+                    if(rx_decoder.size() < header_len + 4)
+                    {
+                        count_rx_error(RX_MALFORMED);
+                        ser_state = START_RECEIVE;
+                        break;
+                    }
+
+                    receive_ack(rx_buf[1]);
+                }
+
+                /*
+                 * Update frames received and go to transmit if queueing
+                 * successful. In full-duplex mode keep receiving, since
+                 * transmission does not wait for received frames.
+                 */
+                serial_frame_handler::parse_status parsed =
+                  serial_frame_handler::commands2queue(rx_buf + header_len,
+                                                       rx_decoder.size() - header_len,
+                                                       rx_queue_,
+                                                       dispatcher_,
+                                                       &reply_queue_,
+                                                       link_command,
+                                                       this);
+
+                if(parsed == serial_frame_handler::PARSE_OK)
+                {
+                    rx_frames_.fetch_add(1);
+                    rx_complete_us = time_us();
+                    latency_[LATENCY_RX_DECODE].record(
+                      rx_decode_us + rx_complete_us - delimiter_us);
+
+                    /*
+                     * A valid frame confirms the current baud rate.
+                     */
+                    last_rx_time = brain_ptr->Timer.system();
+                    confirmed_baud = current_baud;
+                    check_link_quality();
+
+                    if(mode_ == FULL_DUPLEX)
+                    {
+                        receive_sequence(rx_buf[0],
+                                         serial_frame_handler::command_count(
+                                           rx_buf + header_len,
+                                           rx_decoder.size() - header_len));
+                        ser_state = START_RECEIVE;
+                    }
+                    else
+                    {
+                        ser_state = TRANSMITTING;
+                    }
+                }
+
+                /*
+                 * Report error and reset if queueing failed.
+                 */
+                else
+                {
+                    count_rx_error(parsed == serial_frame_handler::PARSE_OVERSIZE ? RX_OVERSIZE :
+                                   parsed == serial_frame_handler::PARSE_CHECKSUM ? RX_CHECKSUM :
+                                   parsed == serial_frame_handler::PARSE_QUEUE_FULL ? RX_QUEUE_FULL :
+                                   RX_MALFORMED);
+                    ser_state = START_RECEIVE;
+                }
+
+                break;
+            }
+
+            /*
+             * Add the bytes decoded this iteration to the running CRC
+             * while the frame is still arriving.
+             */
+            if(ser_state == RECEIVING)
+            {
+                rx_crc.update(rx_buf + rx_crc_len,
+                              rx_decoder.size() - rx_crc_len);
+                rx_crc_len = rx_decoder.size();
+            }
+
+            break;
+        }
+    }
+
+    /*
+     * In full-duplex mode transmission runs independently of the
+     * receive state machine, limited by the in-flight window.
+     */
+    if(mode_ == FULL_DUPLEX)
+    {
+        uint32_t now = brain_ptr->Timer.system();
+        expire_in_flight(now);
+
+        if(can_transmit(now))
+        {
+            transmit_frame();
+        }
+    }
+
+    /*
+     * Switch or fall back the baud rate when due.
+     */
+    uint32_t now = brain_ptr->Timer.system();
+    check_link_loss(now);
+
+    /*
+     * Work out the next time there is likely to be work, waking in time for
+     * an armed baud rate switch.
+     */
+    uint32_t wake_time = next_wake_time(now);
+
+    if(baud_switch_armed && time_before(baud_switch_time, wake_time))
+    {
+        wake_time = baud_switch_time;
+    }
+
+    return wake_time;
+}
\ No newline at end of file
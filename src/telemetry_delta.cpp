@@ -0,0 +1,202 @@
+/*
+ * Implementation of telemetry_delta class.
+ */
+
+#include <cstring>
+#include "telemetry_delta.h"
+#include "serial_frame.h"
+
+/*
+ * Constructor for a table without references.
+ */
+telemetry_delta::telemetry_delta()
+{
+    reset();
+}
+
+/*
+ * Drops every reference, so the next frame sends full payloads.
+ */
+void telemetry_delta::reset()
+{
+    memset(entries, 0, sizeof(entries));
+    frame_id_ = 0;
+    base_id_ = NO_BASE;
+}
+
+/*
+ * Starts a new frame. Payloads recorded for the previous frame that was not
+ * acknowledged are forgotten.
+ */
+void telemetry_delta::begin_frame()
+{
+    for(size_t i = 0; i < MAX_ENTRIES; i++)
+    {
+        entries[i].pending_valid = false;
+    }
+
+    frame_id_++;
+
+    if(frame_id_ == NO_BASE)
+    {
+        frame_id_ = 0;
+    }
+}
+
+/*
+ * Returns the id of the frame being built.
+ */
+uint8_t telemetry_delta::frame_id()
+{
+    return frame_id_;
+}
+
+/*
+ * Returns the id of the frame whose payloads are the references.
+ */
+uint8_t telemetry_delta::base_id()
+{
+    return base_id_;
+}
+
+/*
+ * Encodes the payload of a command as differences to its reference.
+ *
+ * @param command The command being transmitted.
+ * @param out The buffer the encoding is written to, at least MAX_DELTA_LEN
+ * bytes.
+ * @return The length of the encoding, or 0 if the payload must be sent in
+ * full because there is no reference or the encoding would not be shorter.
+ */
+size_t telemetry_delta::encode(const serial_command &command, uint8_t *out)
+{
+    delta_entry *entry = find(command.address, false);
+
+    if(entry == nullptr ||
+       !entry->ref_valid ||
+       entry->ref_size != command.payload_size ||
+       command.payload_size == 0)
+    {
+        return 0;
+    }
+
+    size_t len = 0;
+
+    for(size_t start = 0; start < command.payload_size; start += 4)
+    {
+        size_t end = start + 4 < command.payload_size ? start + 4 : command.payload_size;
+        uint32_t value = 0;
+        uint32_t ref = 0;
+
+        for(size_t i = start; i < end; i++)
+        {
+            value = (value << 8) | command.data[i];
+            ref = (ref << 8) | entry->ref[i];
+        }
+
+        /*
+         * Sign extend the difference of the word, then zig-zag it.
+         */
+        size_t shift = 32 - 8 * (end - start);
+        int32_t delta = static_cast<int32_t>((value - ref) << shift) >> shift;
+        uint32_t zigzag = (static_cast<uint32_t>(delta) << 1) ^
+                          static_cast<uint32_t>(delta >> 31);
+
+        while(zigzag >= 0x80)
+        {
+            out[len++] = static_cast<uint8_t>(zigzag | 0x80);
+            zigzag >>= 7;
+        }
+
+        out[len++] = static_cast<uint8_t>(zigzag);
+    }
+
+    return len < command.payload_size ? len : 0;
+}
+
+/*
+ * Remembers the payload of a command sent in the current frame, to become
+ * its reference once the frame is acknowledged. If the table is full the
+ * address is simply not tracked.
+ *
+ * @param command The command being transmitted.
+ */
+void telemetry_delta::record(const serial_command &command)
+{
+    delta_entry *entry = find(command.address, true);
+
+    if(entry == nullptr)
+    {
+        return;
+    }
+
+    entry->pending_valid = true;
+    entry->pending_size = command.payload_size;
+    memcpy(entry->pending, command.data, command.payload_size);
+}
+
+/*
+ * Handles the master acknowledging a frame. If it is the frame just sent,
+ * its payloads become the references and it becomes the base.
+ *
+ * @param id The id of the acknowledged frame.
+ */
+void telemetry_delta::ack(uint8_t id)
+{
+    if(id != frame_id_)
+    {
+        return;
+    }
+
+    for(size_t i = 0; i < MAX_ENTRIES; i++)
+    {
+        delta_entry &entry = entries[i];
+
+        if(entry.used && entry.pending_valid)
+        {
+            entry.ref_valid = true;
+            entry.ref_size = entry.pending_size;
+            memcpy(entry.ref, entry.pending, entry.pending_size);
+        }
+
+        entry.pending_valid = false;
+    }
+
+    base_id_ = id;
+}
+
+/*
+ * Finds the entry of an address.
+ *
+ * @param address The address.
+ * @param insert If a free entry should be taken for an address without one.
+ * @return The entry, or nullptr if there is none.
+ */
+telemetry_delta::delta_entry *telemetry_delta::find(uint16_t address, bool insert)
+{
+    size_t slot = static_cast<size_t>((address * 2654435761u) >> 16) % MAX_ENTRIES;
+
+    for(size_t i = 0; i < PROBE_LIMIT; i++)
+    {
+        delta_entry &entry = entries[(slot + i) % MAX_ENTRIES];
+
+        if(entry.used && entry.address == address)
+        {
+            return &entry;
+        }
+
+        if(!entry.used)
+        {
+            if(!insert)
+            {
+                return nullptr;
+            }
+
+            entry.used = true;
+            entry.address = address;
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}